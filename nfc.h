@@ -25,29 +25,143 @@
 #include <linux/types.h>
 
 // The device's interface consists of:
-// An ioctl to get the protocol version.
-// A blocking I/O interface with messages with the chip.
+// Ioctls to get and set the protocol version.
+// A blocking I/O interface with messages with the chip. With O_NONBLOCK,
+// read() fails with EAGAIN if no message is available and write() fails with
+// EAGAIN while a previous command is running. poll() reports POLLIN when a
+// message can be read and POLLOUT when a message can be written.
+// An optional shared ring to consume messages from the chip (see below).
 
 /* ioctl definitions */
 
 #define NFC_RD_GET_PROTOCOL_VERSION _IOR('N', 0, uint64_t)
+#define NFC_WR_SET_PROTOCOL_VERSION _IOW('N', 1, uint64_t)
+#define NFC_WR_SET_OVERFLOW_POLICY _IOW('N', 2, uint32_t)
+#define NFC_WR_SET_BUFFER_SIZE _IOW('N', 3, uint32_t)
+#define NFC_RD_READ_EVENTS _IOW('N', 4, struct nfc_read_events_request)
+#define NFC_WR_SET_EVENTFD _IOW('N', 5, struct nfc_eventfd_request)
+
+// Size of the buffer of messages from the driver, in bytes, is set by
+// read_buffer_size module parameter when the device is opened (8 KiB by
+// default). It can be changed while no message is queued, otherwise the ioctl
+// fails with EBUSY. Size is rounded up to a power of two between 2 KiB and
+// 1 MiB. Messages larger than the buffer are dropped.
+
+// Read up to max_count messages from the driver at once, one per slot of
+// slot_size bytes. Each slot begins with the message header, which gives its
+// type and length, followed by the payload, truncated if it does not fit. The
+// ioctl returns the number of messages.
+// Like read(), it waits for a first message unless the device was opened with
+// O_NONBLOCK. Before that, if min_count is more than one, it waits for
+// min_count messages or for timeout_ms milliseconds (0 meaning no timeout),
+// whichever comes first.
+// It fails with EBUSY if a message was partially read with read() or if the
+// event ring is mapped.
+struct nfc_read_events_request {
+	uint64_t slots; // pointer to max_count * slot_size bytes
+	uint32_t slot_size; // at least sizeof(struct nfc_message_header_v2)
+	uint32_t max_count;
+	uint32_t min_count;
+	uint32_t timeout_ms;
+};
+
+// Bind an eventfd to the device, signalled when a message from the driver is
+// queued. Only messages of types in message_types mask (1 << message type)
+// signal it, or every message if mask is 0. A fd of -1 unbinds the eventfd.
+// Clients can also get SIGIO with fcntl F_SETOWN and O_ASYNC.
+struct nfc_eventfd_request {
+	int32_t fd;
+	uint32_t reserved;
+	uint64_t message_types;
+};
 
-// This version
+// Protocol version is NFC_PROTOCOL_VERSION_1 when the device is opened.
+// Client can switch to another version while no message is queued or
+// partially read and before the event ring is mapped, otherwise the ioctl
+// fails with EBUSY. Sequence numbers start again from 0 after a switch.
+// Drivers that do not support a version fail with EINVAL.
 #define NFC_PROTOCOL_VERSION_1 0x004E464300000001ULL
+// Version 2: messages from driver to client have a nfc_message_header_v2
+// header with a sequence number and a timestamp.
+#define NFC_PROTOCOL_VERSION_2 0x004E464300000002ULL
+
+// What to do with messages from the driver when client does not read them
+// fast enough. Policy is NFC_OVERFLOW_POLICY_DROP_NEWEST when the device is
+// opened. In every case, dropped messages are reported with an overflow
+// message.
+// Drop messages that do not fit.
+#define NFC_OVERFLOW_POLICY_DROP_NEWEST 0
+// Drop oldest unread messages to make room. A message that was partially read
+// is not dropped, the next one is. With the event ring, client owns unread
+// messages, so newest messages are dropped instead.
+#define NFC_OVERFLOW_POLICY_DROP_OLDEST 1
+// Like drop newest, but a detected tag message about a tag (same tag type and
+// UID) that is already queued and not read yet is counted as coalesced instead
+// of dropped: client will read about this tag anyway. Coalesced count of the
+// overflow message is the number of such detections. With the event ring,
+// they are counted as dropped.
+#define NFC_OVERFLOW_POLICY_COALESCE 2
+
+// io_uring passthrough (IORING_OP_URING_CMD, Linux 6.7 and later): cmd_op is
+// one of the commands below and the command area of the submission queue
+// entry holds a nfc_uring_cmd. Commands complete asynchronously, without a
+// blocked thread:
+// NFC_URING_CMD_READ completes like read() once a message is available.
+// NFC_URING_CMD_WRITE completes like a non-blocking write() once the previous
+// command completed, with the number of bytes processed, which is less than
+// len if a message starts a command.
+#define NFC_URING_CMD_READ 0
+#define NFC_URING_CMD_WRITE 1
+
+struct nfc_uring_cmd {
+	uint64_t addr; // buffer
+	uint32_t len; // buffer length in bytes
+	uint32_t reserved;
+};
 
 /* messages */
 
-// A single client can open the device at a time.
+// Several clients can open the device at once. Each opened file has its own
+// queue of messages from the driver, protocol version, overflow policy and
+// event ring. Detected tags are reported to every client.
+//
+// Requests other than identify are processed for a single client at a time,
+// which owns the reader until it goes back to idle mode, for example with an
+// idle mode request, or closes the device. Selected tags, transceive responses
+// and idle mode acknowledgements are only sent to this client. Requests from
+// other clients are denied with a request denied message.
 //
 // Each message between client and driver is composed of a header and a payload.
 // Header is four bytes: message type and payload length (in bytes).
 // Payload is up to 65535 bytes.
+//
+// read() only returns whole messages, as many as fit in the buffer. If the
+// next message does not fit, its first bytes are returned and following reads
+// return the rest of it, so the header and the payload can be read separately.
+//
+// write() and writev() accept several messages at once, processed in order.
+// Each message waits for the command of the previous one to complete. A
+// trailing partial message is kept until the following writes complete it.
+// Messages with a payload larger than 1282 bytes are rejected with EMSGSIZE.
 
 struct nfc_message_header {
 	uint8_t message_type;
 	uint16_t payload_length;
 } __attribute__((packed));
 
+// With version 2, header of messages from driver to client.
+// Sequence is incremented for every message, including messages that were
+// dropped, so gaps reveal lost messages.
+// Timestamp (CLOCK_MONOTONIC, in nanoseconds) is taken at detection for
+// detected and selected tag messages, and at the end of reception (or end of
+// transmission if tag did not answer) for transceive responses.
+struct nfc_message_header_v2 {
+	uint8_t message_type;
+	uint16_t payload_length;
+	uint32_t sequence;
+	uint64_t timestamp;
+} __attribute__((packed));
+
 // ---- Identify request ----
 // Client => Driver
 // Get the name of the chipset.
@@ -82,6 +196,8 @@ struct nfc_message_header {
 // Define discover parameters.
 // Transition the device to discovery mode. The message can also be sent if the
 // device was already in discover mode, thus updating the parameters.
+// Every ISO14443-A tag in the field is detected at each polling cycle: tags are
+// resolved with anticollision and halted one after the other.
 struct nfc_discover_mode_request_message_payload {
 	uint64_t protocols; // protocols to poll for (NFC_TAG_PROTOCOL_*)
 	uint32_t polling_period; // polling period in ms
@@ -95,6 +211,14 @@ struct nfc_discover_mode_request_message_payload {
 // Device will reply with a NFC_SELECTED_TAG_MESSAGE_TYPE instead of
 // NFC_DETECTED_TAG_MESSAGE_TYPE message.
 #define NFC_DISCOVER_FLAGS_SELECT 1
+// Skip polling while more than half of the buffer (or event ring) is unread.
+#define NFC_DISCOVER_FLAGS_THROTTLE 2
+// Between polls finding no tag, let the chip sense amplitude or phase changes
+// of the antenna in low power wake-up mode and only poll after it did.
+#define NFC_DISCOVER_FLAGS_WAKE_UP 4
+// While no tag is present, measure antenna amplitude and phase at each cycle
+// and only poll technologies when they changed, or periodically.
+#define NFC_DISCOVER_FLAGS_PRESCREEN 8
 
 // ---- Detected tag message ----
 // Driver => Client
@@ -251,6 +375,9 @@ struct nfc_select_tag_message_payload {
 // If flag NFC_TRANSCEIVE_FLAGS_TX_ONLY is used, there also is an answer with
 // rx_count equal to 0.
 // If tx_count is 0, no frame is transmitted.
+// If rx_timeout is 0, the driver waits for the frame waiting time of the
+// selected tag, derived from its ATS or ATQB, or from its protocol otherwise.
+// With NFC_TRANSCEIVE_FLAGS_TX_ONLY, rx_timeout is the delay after the frame.
 #define NFC_TRANSCEIVE_FRAME_REQUEST_MESSAGE_TYPE 8
 /// Payload length is variable
 
@@ -291,4 +418,240 @@ struct nfc_message_transceive_frame_response_payload {
 // _ERROR is set if the request failed, including timeout, unless _TIMEOUT was
 // provided. When _ERROR is set, chip is unselected and field is turned off.
 
+// ---- Transceive frames ----
+// Low level interface to exchange a sequence of frames with picc.
+//
+// Client => Driver
+// Transceive frames to selected tag, consecutively and within the same RF
+// session. Only available in selected mode (ignored otherwise).
+// Followed by a single response message from device with the responses to
+// every executed frame.
+// Each frame follows the conventions of
+// NFC_TRANSCEIVE_FRAME_REQUEST_MESSAGE_TYPE.
+#define NFC_TRANSCEIVE_FRAMES_REQUEST_MESSAGE_TYPE 10
+/// Payload length is variable
+
+#define NFC_TRANSCEIVE_FRAMES_MAX_COUNT 32
+
+struct nfc_transceive_frames_request_message_payload {
+	uint8_t flags; // See below
+	uint8_t frame_count; // up to NFC_TRANSCEIVE_FRAMES_MAX_COUNT
+	uint8_t frames[1280]; // frame_count frames, could be less
+} __attribute__((packed));
+
+// Frames are packed one after the other. tx_data length is tx_count bytes, or
+// tx_count bits rounded up to the next byte with NFC_TRANSCEIVE_FLAGS_BITS.
+// rx_timeout is interpreted as with NFC_TRANSCEIVE_FRAME_REQUEST_MESSAGE_TYPE.
+struct nfc_transceive_frames_request_frame {
+	uint16_t tx_count; // in bits or in bytes
+	uint16_t rx_timeout; // timeout in usec before rx starts
+	uint8_t flags; // NFC_TRANSCEIVE_FLAGS_*
+	uint8_t tx_data[512]; // could be less
+} __attribute__((packed));
+
+#define NFC_TRANSCEIVE_FRAMES_FLAGS_STOP_ON_ERROR \
+	1 << 0 // Do not execute frames following a failed frame
+
+// Driver => Client
+#define NFC_TRANSCEIVE_FRAMES_RESPONSE_MESSAGE_TYPE 11
+/// Payload length is variable
+
+struct nfc_transceive_frames_response_message_payload {
+	uint8_t flags; // See below
+	uint8_t frame_count; // number of executed frames
+	uint8_t frames[4096]; // frame_count responses, could be less
+} __attribute__((packed));
+
+// Responses are packed one after the other. rx_data length is rx_count bytes,
+// or rx_count bits rounded up to the next byte with
+// NFC_TRANSCEIVE_RESPONSE_FLAGS_BITS.
+struct nfc_transceive_frames_response_frame {
+	uint16_t rx_count; // in bits or in bytes
+	uint8_t flags; // NFC_TRANSCEIVE_RESPONSE_FLAGS_*
+	uint8_t rx_data[512]; // could be less
+} __attribute__((packed));
+
+#define NFC_TRANSCEIVE_FRAMES_RESPONSE_FLAGS_ERROR \
+	1 << 7 // Request was rejected or a frame failed.
+
+// Frames that fail have NFC_TRANSCEIVE_RESPONSE_FLAGS_ERROR set in their
+// response. If the request was malformed, no frame is executed.
+// With NFC_TRANSCEIVE_FRAMES_FLAGS_STOP_ON_ERROR, execution stops at the first
+// failed frame, and as with a single frame, chip is unselected and field is
+// turned off. Otherwise, remaining frames are executed and tag stays selected.
+// A frame fails if its response does not fit in what is left of the response
+// payload, and execution stops once the response payload is full.
+
+// ---- Transceive script ----
+// Low level interface to run a sequence of exchanges with picc, where each
+// step depends on the response to the previous one.
+//
+// Client => Driver
+// Execute a script with selected tag. Only available in selected mode (ignored
+// otherwise).
+// Script execution starts with step 0. After each step, the response is
+// compared with the step's pattern and execution continues with on_match or
+// on_mismatch step, until NFC_TRANSCEIVE_SCRIPT_END is reached.
+// Execution is bounded by NFC_TRANSCEIVE_SCRIPT_MAX_EXECUTED_STEPS steps and
+// by the timeout.
+// Followed by a single response message from device with the responses to
+// every executed step.
+#define NFC_TRANSCEIVE_SCRIPT_REQUEST_MESSAGE_TYPE 12
+/// Payload length is variable
+
+#define NFC_TRANSCEIVE_SCRIPT_MAX_STEPS 32
+#define NFC_TRANSCEIVE_SCRIPT_MAX_EXECUTED_STEPS 64
+#define NFC_TRANSCEIVE_SCRIPT_MAX_TIMEOUT 2000
+#define NFC_TRANSCEIVE_SCRIPT_MAX_MATCH_LEN 16
+#define NFC_TRANSCEIVE_SCRIPT_END 0xFF
+
+struct nfc_transceive_script_request_message_payload {
+	uint16_t timeout; // in ms, up to NFC_TRANSCEIVE_SCRIPT_MAX_TIMEOUT
+	uint8_t step_count; // up to NFC_TRANSCEIVE_SCRIPT_MAX_STEPS
+	uint8_t steps[1280]; // step_count steps, could be less
+} __attribute__((packed));
+
+// Steps are packed one after the other. Each step is followed by match_len
+// bytes of expected value and then match_len bytes of mask.
+struct nfc_transceive_script_step {
+	uint8_t on_match; // next step, or NFC_TRANSCEIVE_SCRIPT_END
+	uint8_t on_mismatch; // next step, or NFC_TRANSCEIVE_SCRIPT_END
+	uint8_t match_flags; // See below
+	uint8_t match_len; // up to NFC_TRANSCEIVE_SCRIPT_MAX_MATCH_LEN
+	struct nfc_transceive_frames_request_frame frame; // could be less
+} __attribute__((packed));
+
+#define NFC_TRANSCEIVE_SCRIPT_MATCH_TAIL \
+	1 << 0 // Match last bytes of response (e.g. SW1 SW2) instead of first
+
+// A response matches if transceive succeeded, has at least match_len bytes,
+// and these bytes are equal to expected value for every bit set in mask.
+// With match_len of 0, any successful transceive matches.
+
+// Driver => Client
+#define NFC_TRANSCEIVE_SCRIPT_RESPONSE_MESSAGE_TYPE 13
+/// Payload length is variable
+
+struct nfc_transceive_script_response_message_payload {
+	uint8_t flags; // See below
+	uint8_t final_step; // index of last executed step
+	uint8_t step_count; // number of executed steps
+	uint8_t steps[4096]; // step_count responses, could be less
+} __attribute__((packed));
+
+struct nfc_transceive_script_response_step {
+	uint8_t step; // index of executed step
+	uint8_t matched; // whether response matched
+	struct nfc_transceive_frames_response_frame frame; // could be less
+} __attribute__((packed));
+
+#define NFC_TRANSCEIVE_SCRIPT_RESPONSE_FLAGS_LIMIT \
+	1 << 0 // Stopped because of step count or timeout limit
+#define NFC_TRANSCEIVE_SCRIPT_RESPONSE_FLAGS_FULL \
+	1 << 1 // Stopped because response payload is full
+#define NFC_TRANSCEIVE_SCRIPT_RESPONSE_FLAGS_ERROR \
+	1 << 7 // Request was rejected, no step was executed.
+
+// Tag stays selected after the script was executed, whatever its outcome.
+
+// ---- Overflow message ----
+// Driver => Client
+// Messages were dropped or coalesced because client did not read them fast
+// enough. Sent before the next message that fits.
+#define NFC_OVERFLOW_MESSAGE_TYPE 14
+
+struct nfc_overflow_message_payload {
+	uint32_t dropped; // number of dropped messages since last report
+	uint32_t coalesced; // detections of queued tags since last report
+} __attribute__((packed));
+
+// Driver => Client
+// Request was not processed as another client owns the reader.
+#define NFC_REQUEST_DENIED_MESSAGE_TYPE 15
+
+struct nfc_request_denied_message_payload {
+	uint8_t message_type; // type of the denied request
+} __attribute__((packed));
+
+// ---- External field message ----
+// Driver => Client
+// An external field (phone, other reader) was detected when turning the field
+// on, or disappeared. While it is present, polling in discover or select mode
+// is suspended.
+#define NFC_EXTERNAL_FIELD_MESSAGE_TYPE 16
+
+struct nfc_external_field_message_payload {
+	uint8_t present; // 1 when detected, 0 when gone
+} __attribute__((packed));
+
+/* event ring */
+
+// Messages from the driver can also be consumed without read(2) by mapping
+// the device with mmap(2), at offset 0, with a length of one page followed by
+// NFC_EVENT_RING_SIZE bytes. The first page holds the control structure below
+// and the data follows at data_offset. Headers in the ring depend on the
+// protocol version.
+//
+// Once the device is mapped, new messages from the driver are only written to
+// the ring. read(2) returns messages queued before the mapping was created.
+// poll(2) reports POLLIN while head differs from tail.
+//
+// Messages (header and payload) are written at head, aligned on 4 bytes, and
+// head is then updated with release semantics. Client reads head with acquire
+// semantics, processes messages at tail and advances tail by each message
+// length rounded up to 4, modulo size, with release semantics. When a message
+// does not fit before the end of the ring, a padding message fills the end:
+// only its type is meaningful, and client should continue at offset 0.
+
+#define NFC_EVENT_RING_SIZE 65536
+#define NFC_EVENT_RING_PADDING_MESSAGE_TYPE 255
+
+struct nfc_event_ring_control {
+	uint32_t head; // offset of next message to be written, by driver
+	uint32_t tail; // offset of next message to be read, by client
+	uint32_t size; // size of data, NFC_EVENT_RING_SIZE
+	uint32_t data_offset; // offset of data from start of mapping
+};
+
+/* generic netlink */
+
+// Tag events are also multicast with generic netlink family
+// NFC_GENL_FAMILY_NAME, whatever the clients of the device, so any number of
+// processes can watch them. There is one multicast group per technology, so
+// subscribers only receive events for the tag types they are interested in.
+// Detected and selected events are sent when the device reports a tag.
+// Departed events are sent by discovery when a tag found during the previous
+// polling cycle is no longer found.
+
+#define NFC_GENL_FAMILY_NAME "nfcdev"
+#define NFC_GENL_VERSION 1
+
+#define NFC_GENL_GROUP_ISO14443A 0
+#define NFC_GENL_GROUP_ISO14443A_NAME "iso14443a"
+#define NFC_GENL_GROUP_ISO14443B 1
+#define NFC_GENL_GROUP_ISO14443B_NAME "iso14443b"
+#define NFC_GENL_GROUP_ST25TB 2
+#define NFC_GENL_GROUP_ST25TB_NAME "st25tb"
+#define NFC_GENL_GROUP_NFCF 3
+#define NFC_GENL_GROUP_NFCF_NAME "nfcf"
+#define NFC_GENL_GROUP_ISO15693 4
+#define NFC_GENL_GROUP_ISO15693_NAME "iso15693"
+
+// Commands
+#define NFC_GENL_CMD_UNSPEC 0
+#define NFC_GENL_CMD_TAG_DETECTED 1
+#define NFC_GENL_CMD_TAG_SELECTED 2
+#define NFC_GENL_CMD_TAG_DEPARTED 3
+
+// Attributes
+#define NFC_GENL_ATTR_UNSPEC 0
+#define NFC_GENL_ATTR_READER 1 // u32, device number of the reader (st_rdev)
+#define NFC_GENL_ATTR_TIMESTAMP 2 // u64, CLOCK_MONOTONIC in ns
+#define NFC_GENL_ATTR_TAG_TYPE 3 // u8, NFC_TAG_TYPE_*
+#define NFC_GENL_ATTR_UID 4 // binary, uid or pupi of the tag
+// binary, nfc_detected_tag_message_payload, except for departed events
+#define NFC_GENL_ATTR_TAG_INFO 5
+#define NFC_GENL_ATTR_PAD 6
+#define NFC_GENL_ATTR_MAX NFC_GENL_ATTR_PAD
+
 #endif
@@ -25,6 +25,7 @@
 #include <linux/cdev.h>
 #include <linux/device.h>
 #include <linux/i2c.h>
+#include <linux/list.h>
 #include <linux/mutex.h>
 #include <linux/spinlock.h>
 #include <linux/timer.h>
@@ -41,11 +42,16 @@ enum st25r391x_mode {
 	mode_discover,
 	mode_select,
 	mode_selected,
-	mode_transceive_frame
+	mode_transceive_frame,
+	mode_transceive_frames,
+	mode_transceive_script
 };
 
 #define MAX_PACKET_SIZE 1285
-#define CIRCULAR_BUFFER_SIZE 8192
+#define CIRCULAR_BUFFER_SIZE 8192 // default, see read_buffer_size parameter
+#define CIRCULAR_BUFFER_MIN_SIZE 2048
+#define CIRCULAR_BUFFER_MAX_SIZE (1024 * 1024)
+#define MAX_PRESENT_TAGS 8 // bits of present_tags_found
 
 // Data structures
 
@@ -54,6 +60,7 @@ struct st25r391x_tag_id {
 	u8 cid;
 	u8 uid_len;
 	u8 uid[10];
+	u32 fwt_usec; // frame waiting time, for requests with rx_timeout 0
 };
 
 struct st25r391x_discover_params {
@@ -80,11 +87,107 @@ struct st25r391x_transceive_frame_params {
 	u8 tx_data[512];
 };
 
+struct st25r391x_transceive_frames_params {
+	struct st25r391x_tag_id tag_id;
+	u8 flags;
+	u8 frame_count;
+	u16 frames_len;
+	u8 frames[MAX_PACKET_SIZE];
+	struct nfc_transceive_frames_response_message_payload response;
+};
+
+struct st25r391x_transceive_script_params {
+	struct st25r391x_tag_id tag_id;
+	u16 timeout;
+	u8 step_count;
+	u16 step_offsets[NFC_TRANSCEIVE_SCRIPT_MAX_STEPS];
+	u8 steps[MAX_PACKET_SIZE];
+	struct nfc_transceive_script_response_message_payload response;
+};
+
 union st25r391x_mode_params {
 	struct st25r391x_discover_params discover;
 	struct st25r391x_select_params select;
 	struct st25r391x_selected_params selected;
 	struct st25r391x_transceive_frame_params transceive_frame;
+	struct st25r391x_transceive_frames_params transceive_frames;
+	struct st25r391x_transceive_script_params transceive_script;
+};
+
+// Counters of power related operations, including steps of field start-up
+// that were performed or skipped.
+struct st25r391x_power_stats {
+	u32 oscillator_starts;
+	u32 oscillator_start_skips;
+	u32 regulator_adjusts;
+	u32 regulator_adjust_skips;
+	u32 supply_drifts;
+	u32 wake_up_entries;
+	u32 wake_ups;
+	u32 i2c_transactions;
+	u32 prescreen_skips;
+	u32 prescreen_polls;
+	u32 prescreen_misses;
+	u32 external_field_backoffs;
+	u32 runtime_suspends;
+	u32 runtime_resumes;
+	u32 resume_latency_us; // of last runtime resume
+	u32 resume_latency_max_us;
+};
+
+// Low power wake-up mode state, see st25r391x_wakeup.c
+struct st25r391x_wakeup_state {
+	u8 amplitude_reference;
+	u8 phase_reference;
+	unsigned enabled : 1; // whether chip is in wake-up mode
+};
+
+// Discovery pre-screen state, see st25r391x_prescreen.c
+struct st25r391x_prescreen_state {
+	u16 amplitude_baseline; // moving average, fixed point
+	u16 phase_baseline;
+	u8 amplitude; // last measurements
+	u8 phase;
+	u8 threshold; // adaptive, in A/D converter LSB
+	u8 skipped; // cycles skipped since technologies were last polled
+	unsigned valid : 1; // whether baseline was learnt
+	unsigned sensed : 1; // whether last poll was caused by a change
+};
+
+// Result of last adjust regulators command, reapplied on field on.
+struct st25r391x_regulator_cache {
+	unsigned long calibrated_at; // jiffies
+	u8 setting; // regulated voltage setting (rege)
+	u8 supply; // A/D converter output of last power supply measurement
+	unsigned valid : 1;
+};
+
+struct st25r391x_i2c_data;
+
+// Per-file data: queue of messages from driver and pending request.
+struct st25r391x_client {
+	struct st25r391x_i2c_data *priv;
+	struct list_head list; // in priv->clients, locked by producer_lock
+	struct mutex consumer_lock; // serializes readers
+	wait_queue_head_t read_wq;
+	int read_buffer_head;
+	int read_buffer_tail;
+	size_t read_message_remaining; // bytes left of a partially read message
+	u32 read_buffer_size; // power of two
+	char *read_buffer;
+	struct nfc_event_ring_control *event_ring; // mapped ring, or NULL
+	u32 event_ring_head; // driver copy of event_ring->head
+	u64 protocol_version; // negotiated NFC_PROTOCOL_VERSION_*
+	u32 sequence; // sequence number of next message
+	u32 overflow_policy; // NFC_OVERFLOW_POLICY_*
+	u32 overflow_dropped; // dropped messages not reported yet
+	u32 overflow_coalesced; // coalesced detections not reported yet
+	u32 read_buffer_drops; // incremented when oldest messages are dropped
+	int write_offset; // current offset in write buffer
+	char write_buffer[MAX_PACKET_SIZE];
+	struct fasync_struct *fasync; // SIGIO subscribers
+	struct eventfd_ctx *eventfd; // bound eventfd, or NULL
+	u64 eventfd_message_types; // mask of message types signalling eventfd
 };
 
 struct st25r391x_i2c_data {
@@ -96,25 +199,42 @@ struct st25r391x_i2c_data {
 	struct device *device;
 	struct timer_list polling_timer;
 	struct work_struct polling_work;
-	spinlock_t producer_lock;
-	spinlock_t consumer_lock;
-	wait_queue_head_t read_wq;
+	struct delayed_work oscillator_off_work;
+	spinlock_t producer_lock; // locks clients list and their queues
+	struct list_head clients;
 	wait_queue_head_t write_wq;
-	int read_buffer_head;
-	int read_buffer_tail;
-	char read_buffer[CIRCULAR_BUFFER_SIZE];
-	int write_offset; // current offset in write buffer
-	char write_buffer[MAX_PACKET_SIZE];
-	struct mutex command_lock; // locks mode and params
-	unsigned opened : 1; // whether the device is opened
+	struct mutex command_lock; // locks mode, params and lease
+	int client_count; // number of opened files
+	struct st25r391x_client *lease; // client owning the reader, or NULL
+	// Whether we're currently running a command. Read without the lock, so
+	// not part of the bitfields below.
+	bool running_command;
+	// Set by runtime resume, which runs without the lock, when the chip was
+	// configured again: cached settings are dropped when leaving idle.
+	bool chip_reset;
 	unsigned field_on : 1; // whether field is on
-	unsigned running_command : 1; // whether we're currently running a command
+	unsigned oscillator_on : 1; // whether oscillator is on (ready mode)
+	unsigned select_field_kept : 1; // whether field was kept on for select
+	unsigned external_field : 1; // whether an external field was detected
+	unsigned reader_only : 1; // no external field detection, no CA
+	unsigned field_guard_timer_valid : 1; // field_guard_timer was written
+	u8 field_guard_timer; // NFC field on guard timer register value
 	enum st25r391x_mode mode;
-	union st25r391x_mode_params mode_params;
+	union st25r391x_mode_params *mode_params; // allocated on first open
+	struct st25r391x_power_stats power_stats;
+	struct st25r391x_regulator_cache regulator;
+	struct st25r391x_wakeup_state wakeup;
+	struct st25r391x_prescreen_state prescreen;
+	unsigned long select_field_deadline; // jiffies, end of select window
+	// Tags found by discovery, to report departed tags.
+	struct st25r391x_tag_id present_tags[MAX_PRESENT_TAGS];
+	u8 present_tags_count;
+	u8 present_tags_found; // bit set for tags found during current cycle
 };
 
 void st25r391x_process_selected_tag(
 	struct st25r391x_i2c_data *priv,
-	const struct nfc_detected_tag_message_payload *tag_payload, u8 cid);
+	const struct nfc_detected_tag_message_payload *tag_payload, u8 cid,
+	u32 fwt_usec);
 
 #endif
@@ -20,7 +20,10 @@
  */
 
 #include <linux/delay.h>
+#include <linux/errno.h>
 #include <linux/i2c.h>
+#include <linux/jiffies.h>
+#include <linux/kernel.h>
 #include <linux/types.h>
 
 #include "st25r391x.h"
@@ -37,12 +40,61 @@ s32 st25r391x_enable_tx_and_rx(struct i2c_client *i2c)
 			ST25R391X_OPERATION_CONTROL_REGISTER_tx_en);
 }
 
+// Slack of the collision avoidance wait, as interrupts are polled over I2C.
+#define ST25R391X_COLLISION_AVOIDANCE_MARGIN_USEC 1000
+
+/**
+ * Program NFC field on guard timer, unless it already has the value.
+ * Return the guard time in timer steps.
+ */
+static s32 st25r391x_set_field_guard_time(struct st25r391x_i2c_data *priv,
+					  u32 guard_time_usec)
+{
+	u32 steps = DIV_ROUND_UP(
+		guard_time_usec,
+		ST25R391X_FC_TO_USEC(
+			ST25R391X_NFC_FILED_ON_GUARD_TIMER_B_REGISTER_step_fc));
+	s32 result;
+
+	if (steps > 0xFF) {
+		steps = 0xFF;
+	}
+	if (priv->field_guard_timer_valid && priv->field_guard_timer == steps) {
+		return steps;
+	}
+	result = st25r391x_write_bank_b_registers(
+		priv->i2c, ST25R391X_NFC_FILED_ON_GUARD_TIMER_B_REGISTER, 1,
+		steps);
+	if (result < 0) {
+		priv->field_guard_timer_valid = 0;
+		return result;
+	}
+	priv->field_guard_timer = steps;
+	priv->field_guard_timer_valid = 1;
+	return steps;
+}
+
 static s32
-st25r391x_perform_collision_avoidance(struct i2c_client *i2c,
-				      struct st25r391x_interrupts *ints)
+st25r391x_perform_collision_avoidance(struct st25r391x_i2c_data *priv,
+				      u32 guard_time_usec)
 {
+	struct i2c_client *i2c = priv->i2c;
+	struct st25r391x_interrupts *ints = &priv->ints;
+	u32 step_usec = ST25R391X_FC_TO_USEC(
+		ST25R391X_NFC_FILED_ON_GUARD_TIMER_B_REGISTER_step_fc);
+	u32 timeout_usec;
 	s32 result;
 
+	result = st25r391x_set_field_guard_time(priv, guard_time_usec);
+	if (result < 0) {
+		return result;
+	}
+	// Chip checks the external field for T_IDT (nfc_n is 0), turns field
+	// on and raises l_cat when the guard timer expires.
+	timeout_usec =
+		ST25R391X_FC_TO_USEC(ST25R391X_COLLISION_AVOIDANCE_T_IDT_FC) +
+		result * step_usec + ST25R391X_COLLISION_AVOIDANCE_MARGIN_USEC;
+
 	st25r391x_clear_interrupts(
 		ints, 0,
 		ST25R391X_TIMER_AND_NFC_INTERRUPT_REGISTER_l_cac |
@@ -57,35 +109,61 @@ st25r391x_perform_collision_avoidance(struct i2c_client *i2c,
 		i2c, ints, 0,
 		ST25R391X_TIMER_AND_NFC_INTERRUPT_REGISTER_l_cac |
 			ST25R391X_TIMER_AND_NFC_INTERRUPT_REGISTER_l_cat,
-		0, 0, 20000); // TODO: check timeout
+		0, 0, timeout_usec);
 	if (result < 0) {
 		dev_err(&i2c->dev,
 			"st25r391x_perform_collision_avoidance: time out waiting for interrupt bits");
 		return result;
 	}
-	if (result & ST25R391X_TIMER_AND_NFC_INTERRUPT_REGISTER_l_cac) {
-		dev_err(&i2c->dev,
+	if (ints->flags[ST25R391X_TIMER_AND_NFC_INTERRUPT_REGISTER -
+			ST25R391X_MAIN_INTERRUPT_REGISTER] &
+	    ST25R391X_TIMER_AND_NFC_INTERRUPT_REGISTER_l_cac) {
+		// External field is present, caller backs off.
+		dev_dbg(&i2c->dev,
 			"st25r391x_perform_collision_avoidance: collision was detected");
-		return -1;
+		return -EBUSY;
 	}
 
 	return 0;
 }
 
+/**
+ * Turn field on without collision avoidance, when reader is the only one
+ * around, and wait for the guard time.
+ */
+static s32 st25r391x_turn_tx_on(struct i2c_client *i2c, u32 guard_time_usec)
+{
+	s32 result;
+
+	result = st25r391x_set_register_bits(
+		i2c, ST25R391X_OPERATION_CONTROL_REGISTER,
+		ST25R391X_OPERATION_CONTROL_REGISTER_tx_en);
+	if (result < 0) {
+		return result;
+	}
+	usleep_range(guard_time_usec, guard_time_usec + 1000);
+	return result;
+}
+
 static s32 st25r391x_turn_oscillator_on(struct i2c_client *i2c,
-					struct st25r391x_interrupts *ints)
+					struct st25r391x_interrupts *ints,
+					bool reader_only)
 {
+	// External field detector is needed for collision avoidance.
+	u8 op_control = ST25R391X_OPERATION_CONTROL_REGISTER_en;
 	s32 result;
 
+	if (!reader_only) {
+		op_control |= ST25R391X_OPERATION_CONTROL_REGISTER_en_fd_c1 |
+			      ST25R391X_OPERATION_CONTROL_REGISTER_en_fd_c0;
+	}
+
 	// Enable oscillator
 	do {
 		st25r391x_clear_interrupts(
 			ints, ST25R391X_MAIN_INTERRUPT_REGISTER_l_osc, 0, 0, 0);
 		result = st25r391x_write_register_byte_check(
-			i2c, ST25R391X_OPERATION_CONTROL_REGISTER,
-			ST25R391X_OPERATION_CONTROL_REGISTER_en |
-				ST25R391X_OPERATION_CONTROL_REGISTER_en_fd_c1 |
-				ST25R391X_OPERATION_CONTROL_REGISTER_en_fd_c0);
+			i2c, ST25R391X_OPERATION_CONTROL_REGISTER, op_control);
 		if (result < 0)
 			break;
 		// "Since the start-up time varies with crystal type, temperature and other parameters, the oscillator amplitude is observed and an interrupt is generated when stable oscillator operation is reached."
@@ -127,44 +205,207 @@ static s32 st25r391x_turn_oscillator_off(struct i2c_client *i2c)
 	return result;
 }
 
+/**
+ * Turn field and oscillator off.
+ */
+s32 st25r391x_power_down(struct st25r391x_i2c_data *priv)
+{
+	s32 result = st25r391x_turn_oscillator_off(priv->i2c);
+	priv->oscillator_on = 0;
+	priv->field_on = 0;
+	priv->wakeup.enabled = 0;
+	return result;
+}
+
+/**
+ * Run a measurement or calibration command and wait for its completion.
+ */
+static s32 st25r391x_run_dct_command(struct i2c_client *i2c,
+				     struct st25r391x_interrupts *ints, u8 cmd)
+{
+	s32 result;
+
+	do {
+		st25r391x_clear_interrupts(
+			ints, 0,
+			ST25R391X_TIMER_AND_NFC_INTERRUPT_REGISTER_l_dct, 0, 0);
+		result = st25r391x_direct_command(i2c, cmd);
+		if (result < 0)
+			break;
+		result = st25r391x_polling_wait_for_interrupt_bit(
+			i2c, ints, 0,
+			ST25R391X_TIMER_AND_NFC_INTERRUPT_REGISTER_l_dct, 0, 0,
+			cmd == ST25R391X_ADJUST_REGULATORS_COMMAND_CODE ?
+				ST25R391X_ADJUST_REGULATORS_USEC :
+				ST25R391X_MEASURE_USEC);
+	} while (0);
+	return result;
+}
+
+s32 st25r391x_measure(struct i2c_client *i2c,
+		      struct st25r391x_interrupts *ints, u8 cmd)
+{
+	s32 result;
+
+	result = st25r391x_run_dct_command(i2c, ints, cmd);
+	if (result >= 0)
+		result = st25r391x_read_register_byte(
+			i2c, ST25R391X_AD_CONVERTER_OUTPUT_REGISTER);
+	return result;
+}
+
+/**
+ * Measure VDD and invalidate cached regulator setting if it drifted.
+ */
+static s32 st25r391x_check_supply(struct st25r391x_i2c_data *priv,
+				  u32 supply_drift_mv)
+{
+	struct i2c_client *i2c = priv->i2c;
+	struct st25r391x_regulator_cache *regulator = &priv->regulator;
+	s32 result;
+	u32 drift_uv;
+
+	do {
+		// Measure VDD, keeping regulated voltage setting.
+		result = st25r391x_clear_register_bits(
+			i2c, ST25R391X_REGULATOR_VOLTAGE_CONTROL_REGISTER,
+			ST25R391X_REGULATOR_VOLTAGE_CONTROL_REGISTER_mpsv_mask);
+		if (result < 0)
+			break;
+		result = st25r391x_measure(
+			i2c, &priv->ints,
+			ST25R391X_MEASURE_POWER_SUPPLY_COMMAND_CODE);
+		if (result < 0)
+			break;
+		drift_uv = abs(result - regulator->supply) *
+			   ST25R391X_MEASURE_POWER_SUPPLY_UV_PER_LSB;
+		if (regulator->valid && supply_drift_mv &&
+		    drift_uv > supply_drift_mv * 1000) {
+			regulator->valid = 0;
+			priv->power_stats.supply_drifts++;
+		}
+		if (!regulator->valid)
+			regulator->supply = result;
+	} while (0);
+	return result;
+}
+
+/**
+ * Run adjust regulators command and cache the resulting setting.
+ */
+static s32 st25r391x_adjust_regulators(struct st25r391x_i2c_data *priv)
+{
+	struct i2c_client *i2c = priv->i2c;
+	struct st25r391x_regulator_cache *regulator = &priv->regulator;
+	s32 result;
+
+	do {
+		// Command only adjusts the regulators in automatic mode
+		result = st25r391x_clear_register_bits(
+			i2c, ST25R391X_REGULATOR_VOLTAGE_CONTROL_REGISTER,
+			ST25R391X_REGULATOR_VOLTAGE_CONTROL_REGISTER_reg_s);
+		if (result < 0)
+			break;
+		result = st25r391x_run_dct_command(
+			i2c, &priv->ints,
+			ST25R391X_ADJUST_REGULATORS_COMMAND_CODE);
+		if (result < 0)
+			break;
+		result = st25r391x_read_bank_b_register_byte(
+			i2c, ST25R391X_REGULATOR_DISPLAY_B_REGISTER);
+		if (result < 0)
+			break;
+		result &= ST25R391X_REGULATOR_DISPLAY_B_REGISTER_reg_mask;
+		regulator->setting =
+			result >> ST25R391X_REGULATOR_DISPLAY_B_REGISTER_reg_shift;
+		regulator->calibrated_at = jiffies;
+		regulator->valid = 1;
+		priv->power_stats.regulator_adjusts++;
+	} while (0);
+	return result;
+}
+
+/**
+ * Set regulated voltage to cached setting.
+ */
+static s32 st25r391x_apply_regulators(struct st25r391x_i2c_data *priv)
+{
+	s32 result;
+	u8 rege = priv->regulator.setting
+		  << ST25R391X_REGULATOR_VOLTAGE_CONTROL_REGISTER_rege_shift;
+
+	result = st25r391x_write_register_byte_check(
+		priv->i2c, ST25R391X_REGULATOR_VOLTAGE_CONTROL_REGISTER,
+		ST25R391X_REGULATOR_VOLTAGE_CONTROL_REGISTER_reg_s | rege |
+			ST25R391X_REGULATOR_VOLTAGE_CONTROL_REGISTER_mpsv_vdd);
+	if (result >= 0)
+		priv->power_stats.regulator_adjust_skips++;
+	return result;
+}
+
 /**
  * Turn field on and set it up.
  */
-s32 st25r391x_turn_field_on(struct st25r391x_i2c_data *priv)
+s32 st25r391x_turn_field_on(struct st25r391x_i2c_data *priv,
+			    unsigned long regulator_max_age,
+			    u32 supply_drift_mv, u32 guard_time_usec)
 {
 	struct i2c_client *i2c = priv->i2c;
 	struct st25r391x_interrupts *ints = &priv->ints;
+	struct st25r391x_regulator_cache *regulator = &priv->regulator;
+	bool oscillator_started = false;
 	s32 result;
 
 	// Set this bit on now to always try to turn it off when leaving.
 	priv->field_on = 1;
 
-	result = st25r391x_turn_oscillator_on(i2c, ints);
-	if (result < 0) {
-		dev_err(priv->device,
-			"st25r391x_turn_field_on: Failed to turn oscillator on: %d",
-			result);
-		return result;
+	// Oscillator is kept on (ready mode) between cycles. On any error, it
+	// is fully started again next time.
+	if (priv->oscillator_on) {
+		priv->power_stats.oscillator_start_skips++;
+	} else {
+		result = st25r391x_turn_oscillator_on(i2c, ints,
+						      priv->reader_only);
+		if (result < 0) {
+			dev_err(priv->device,
+				"st25r391x_turn_field_on: Failed to turn oscillator on: %d",
+				result);
+			return result;
+		}
+		priv->oscillator_on = 1;
+		priv->wakeup.enabled = 0; // wu bit was cleared with en
+		priv->power_stats.oscillator_starts++;
+		oscillator_started = true;
 	}
 
-	// Adjust regulators
-	st25r391x_clear_interrupts(
-		ints, 0, ST25R391X_TIMER_AND_NFC_INTERRUPT_REGISTER_l_dct, 0,
-		0);
-	result = st25r391x_direct_command(
-		i2c, ST25R391X_ADJUST_REGULATORS_COMMAND_CODE);
-	if (result < 0) {
-		dev_err(priv->device,
-			"st25r391x_turn_field_on: Failed to send adjust regulators command code %d",
-			result);
-		return result;
+	// Regulators are adjusted when the cached setting is too old, the
+	// supply drifted or after an error. Supply is measured when the
+	// oscillator is started or the setting is refreshed.
+	if (regulator->valid &&
+	    !time_before(jiffies, regulator->calibrated_at + regulator_max_age))
+		regulator->valid = 0;
+	if (oscillator_started || !regulator->valid) {
+		result = st25r391x_check_supply(priv, supply_drift_mv);
+		if (result < 0) {
+			dev_err(priv->device,
+				"st25r391x_turn_field_on: Failed to measure power supply: %d",
+				result);
+			priv->oscillator_on = 0;
+			regulator->valid = 0;
+			return result;
+		}
+	}
+	if (regulator->valid) {
+		result = st25r391x_apply_regulators(priv);
+	} else {
+		result = st25r391x_adjust_regulators(priv);
 	}
-	result = st25r391x_polling_wait_for_interrupt_bit(
-		i2c, ints, 0, ST25R391X_TIMER_AND_NFC_INTERRUPT_REGISTER_l_dct,
-		0, 0, 10000); // TODO: check timeout
 	if (result < 0) {
 		dev_err(priv->device,
-			"st25r391x_turn_field_on: Time out waiting for interrupt bit (adjust regulators command)");
+			"st25r391x_turn_field_on: Failed to adjust regulators: %d",
+			result);
+		priv->oscillator_on = 0;
+		regulator->valid = 0;
 		return result;
 	}
 	// STOP & Reset RX Gain
@@ -173,6 +414,8 @@ s32 st25r391x_turn_field_on(struct st25r391x_i2c_data *priv)
 		dev_err(priv->device,
 			"st25r391x_turn_field_on: Failed to send stop command code %d",
 			result);
+		priv->oscillator_on = 0;
+		regulator->valid = 0;
 		return result;
 	}
 	result = st25r391x_direct_command(i2c,
@@ -181,32 +424,72 @@ s32 st25r391x_turn_field_on(struct st25r391x_i2c_data *priv)
 		dev_err(priv->device,
 			"st25r391x_turn_field_on: Failed to send reset rx gain command code %d",
 			result);
+		priv->oscillator_on = 0;
+		regulator->valid = 0;
 		return result;
 	}
 	// Perform collision avoidance and turn field on
-	result = st25r391x_perform_collision_avoidance(i2c, ints);
-	if (result < 0) {
+	if (priv->reader_only) {
+		result = st25r391x_turn_tx_on(i2c, guard_time_usec);
+	} else {
+		result = st25r391x_perform_collision_avoidance(
+			priv, guard_time_usec);
+	}
+	if (result < 0 && result != -EBUSY) {
 		dev_err(priv->device,
-			"st25r391x_turn_field_on: Failed to perform collision avoidance: %d (will not abort)",
+			"st25r391x_turn_field_on: Failed to turn field on: %d",
 			result);
 	}
 	return result;
 }
 
 /**
- * Turn field off.
+ * Turn field off, keeping the oscillator on for the next cycle.
  */
 s32 st25r391x_turn_field_off(struct st25r391x_i2c_data *priv)
 {
-	s32 result = st25r391x_turn_oscillator_off(priv->i2c);
+	s32 result;
+
+	if (!priv->oscillator_on) {
+		return st25r391x_power_down(priv);
+	}
+	result = st25r391x_clear_register_bits(
+		priv->i2c, ST25R391X_OPERATION_CONTROL_REGISTER,
+		ST25R391X_OPERATION_CONTROL_REGISTER_rx_en |
+			ST25R391X_OPERATION_CONTROL_REGISTER_tx_en);
+	if (result < 0) {
+		dev_err(priv->device,
+			"st25r391x_turn_field_off: Failed to clear operation control register bits %d",
+			result);
+		return st25r391x_power_down(priv);
+	}
 	priv->field_on = 0;
 	return result;
 }
 
+u32 st25r391x_iso14443_fwt_usec(u8 fwi)
+{
+	if (fwi > ST25R391X_ISO14443_MAX_FWI) {
+		fwi = ST25R391X_ISO14443_DEFAULT_FWI;
+	}
+	// FWT = 256 * 16/fc * 2^FWI, delta FWT = 49152/fc
+	return (ST25R391X_FC_TO_USEC(4096) << fwi) +
+	       ST25R391X_FC_TO_USEC(49152) + ST25R391X_RX_TIMEOUT_MARGIN_USEC;
+}
+
+u32 st25r391x_iso14443_sfgt_usec(u8 sfgi)
+{
+	if (sfgi == 0 || sfgi > ST25R391X_ISO14443_MAX_FWI) {
+		return 0;
+	}
+	// SFGT = 256 * 16/fc * 2^SFGI, delta SFGT = 384/fc * 2^SFGI
+	return ST25R391X_FC_TO_USEC(4096 + 384) << sfgi;
+}
+
 s32 st25r391x_transceive_frame(struct i2c_client *i2c,
 			       struct st25r391x_interrupts *ints,
 			       const u8 *tx_buf, u16 tx_count, u8 *rx_buf,
-			       u16 rx_buf_len, int flags, u16 rx_timeout_usec)
+			       u16 rx_buf_len, int flags, u32 rx_timeout_usec)
 {
 	s32 result;
 	u16 tx_bits_count;
@@ -299,7 +582,7 @@ s32 st25r391x_transceive_frame(struct i2c_client *i2c,
 			result = st25r391x_polling_wait_for_interrupt_bit(
 				i2c, ints,
 				ST25R391X_MAIN_INTERRUPT_REGISTER_l_txe, 0, 0,
-				0, 5000); // TODO: check timeout
+				0, ST25R391X_FRAME_USEC(tx_bytes_count));
 			if (result < 0)
 				break;
 		}
@@ -325,7 +608,7 @@ s32 st25r391x_transceive_frame(struct i2c_client *i2c,
 			result = st25r391x_polling_wait_for_interrupt_bit(
 				i2c, ints,
 				ST25R391X_MAIN_INTERRUPT_REGISTER_l_rxe, 0, 0,
-				0, 5000); // TODO: check timeout
+				0, ST25R391X_FRAME_USEC(rx_buf_len));
 			if (result < 0)
 				break;
 			result = st25r391x_read_fifo(i2c, rx_buf_len, rx_buf,
@@ -23,6 +23,7 @@
 #define ST25R391X_COMMON_H
 
 #include <linux/i2c.h>
+#include <linux/kernel.h>
 #include <linux/types.h>
 
 struct st25r391x_interrupts;
@@ -40,12 +41,64 @@ enum transceive_frame_flag {
 	transceive_frame_no_par_rx = 1 << 6,
 };
 
+// Frame timings, from ISO/IEC 14443 and JIS X 6319-4, are expressed in
+// carrier periods (1/fc, fc = 13.56 MHz). Convert them to usec, rounding up.
+#define ST25R391X_FC_TO_USEC(n) DIV_ROUND_UP((n) * 100, 1356)
+// Slack added to response timeouts, as interrupts are polled over I2C.
+#define ST25R391X_RX_TIMEOUT_MARGIN_USEC 100
+// Upper bound of the duration of a frame of n bytes (10 etu of 128/fc per
+// byte, plus SoF, EoF and CRC), used for end of tx and end of rx waits.
+#define ST25R391X_FRAME_USEC(n) (ST25R391X_FC_TO_USEC(((n) + 4) * 1280) + 1000)
+
+// ISO14443-3A: FDT of ATQA, anticollision and SAK responses (n = 9).
+#define ST25R391X_NFCA_FDT_USEC \
+	(ST25R391X_FC_TO_USEC(1236) + ST25R391X_RX_TIMEOUT_MARGIN_USEC)
+// ISO14443-4: FWT for the ATS, 65536/fc.
+#define ST25R391X_NFCA_ATS_FWT_USEC \
+	(ST25R391X_FC_TO_USEC(65536) + ST25R391X_RX_TIMEOUT_MARGIN_USEC)
+// NFC Forum Type 2 Tag: FWT of the WRITE command, the slowest one. Used for
+// ISO14443-3A tags that do not support ISO14443-4.
+#define ST25R391X_NFCA_T2T_FWT_USEC 10000
+// ISO14443-3B: FWT for the ATQB, 7680/fc. ST25TB tags answer within the
+// same window (TR0 + TR1 + SoF).
+#define ST25R391X_NFCB_ATQB_FWT_USEC \
+	(ST25R391X_FC_TO_USEC(7680) + ST25R391X_RX_TIMEOUT_MARGIN_USEC)
+// JIS X 6319-4: SENSF_RES is sent in one of TSN + 1 time slots of 256*64/fc
+// starting 512*64/fc after SENSF_REQ.
+#define ST25R391X_NFCF_SENSF_RES_USEC(tsn)                             \
+	(ST25R391X_FC_TO_USEC((512 + 256 * ((tsn) + 1)) * 64) + \
+	 ST25R391X_RX_TIMEOUT_MARGIN_USEC)
+// NFC Forum Activity: guard time between field on and the first poll.
+#define ST25R391X_NFCA_GUARD_TIME_USEC 5100
+#define ST25R391X_NFCB_GUARD_TIME_USEC 5100
+#define ST25R391X_NFCF_GUARD_TIME_USEC 20400
+// Duration of direct commands signalled with the l_dct interrupt: adjusting
+// regulators takes up to 6 ms, A/D conversions of measurements up to 100 usec.
+#define ST25R391X_ADJUST_REGULATORS_USEC \
+	(6000 + ST25R391X_RX_TIMEOUT_MARGIN_USEC)
+#define ST25R391X_MEASURE_USEC (100 + ST25R391X_RX_TIMEOUT_MARGIN_USEC)
+// ISO14443-4: FWI and SFGI are 4 bits, 15 being RFU.
+#define ST25R391X_ISO14443_MAX_FWI 14
+#define ST25R391X_ISO14443_DEFAULT_FWI 4
+
 s32 st25r391x_enable_tx_and_rx(struct i2c_client *i2c);
-s32 st25r391x_turn_field_on(struct st25r391x_i2c_data *priv);
+// Return -EBUSY if collision avoidance detected an external field.
+// Return once guard_time_usec elapsed since field was turned on.
+s32 st25r391x_turn_field_on(struct st25r391x_i2c_data *priv,
+			    unsigned long regulator_max_age,
+			    u32 supply_drift_mv, u32 guard_time_usec);
 s32 st25r391x_turn_field_off(struct st25r391x_i2c_data *priv);
+s32 st25r391x_power_down(struct st25r391x_i2c_data *priv);
+// Run a measure command and return the A/D converter output.
+s32 st25r391x_measure(struct i2c_client *i2c,
+		      struct st25r391x_interrupts *ints, u8 cmd);
+// Frame waiting time (FWT + delta FWT), in usec, for a given FWI.
+u32 st25r391x_iso14443_fwt_usec(u8 fwi);
+// Start-up frame guard time, in usec, for a given SFGI, 0 if none.
+u32 st25r391x_iso14443_sfgt_usec(u8 sfgi);
 s32 st25r391x_transceive_frame(struct i2c_client *i2c,
 			       struct st25r391x_interrupts *ints,
 			       const u8 *tx_buf, u16 tx_count, u8 *rx_buf,
-			       u16 rx_buf_len, int flags, u16 rx_timeout_usec);
+			       u16 rx_buf_len, int flags, u32 rx_timeout_usec);
 
 #endif
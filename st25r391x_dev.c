@@ -22,31 +22,637 @@
 #include <linux/wait.h>
 #include <linux/workqueue.h>
 #include <linux/circ_buf.h>
+#include <linux/eventfd.h>
+#include <linux/fs.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include <linux/timekeeping.h>
+#include <linux/uaccess.h>
+#include <linux/version.h>
+
+#include "nfc.h"
 
 #include "st25r391x.h"
 #include "st25r391x_dev.h"
 
-void st25r391x_write_to_device(struct st25r391x_i2c_data *priv, const u8 *data,
-			       int count)
+/**
+ * Copy data into the circular buffer at head, in at most two chunks.
+ * Return the new head.
+ */
+static unsigned long st25r391x_copy_to_buffer(struct st25r391x_client *client,
+					      unsigned long head,
+					      const u8 *data, u16 count)
 {
-	int ix;
-	spin_lock(&priv->producer_lock);
+	unsigned long chunk = client->read_buffer_size - head;
+
+	if (chunk > count) {
+		chunk = count;
+	}
+	memcpy(&client->read_buffer[head], data, chunk);
+	memcpy(&client->read_buffer[0], data + chunk, count - chunk);
+	return (head + count) & (client->read_buffer_size - 1);
+}
+
+/**
+ * Length of headers of messages from driver, depending on protocol version.
+ */
+static u16 st25r391x_header_len(struct st25r391x_client *client)
+{
+	if (client->protocol_version == NFC_PROTOCOL_VERSION_2) {
+		return sizeof(struct nfc_message_header_v2);
+	}
+	return sizeof(struct nfc_message_header);
+}
+
+/**
+ * Copy count bytes at offset in the circular buffer.
+ */
+static void st25r391x_peek_buffer(struct st25r391x_client *client,
+				  unsigned long offset, void *data,
+				  size_t count)
+{
+	u8 *bytes = data;
+	size_t ix;
+
 	for (ix = 0; ix < count; ix++) {
-		unsigned long head = priv->read_buffer_head;
-		/* The spin_unlock() and next spin_lock() provide needed ordering. */
-		unsigned long tail = READ_ONCE(priv->read_buffer_tail);
-		if (CIRC_SPACE(head, tail, CIRCULAR_BUFFER_SIZE) >=
-		    count - ix) {
-			priv->read_buffer[head] = data[ix];
-			smp_store_release(&priv->read_buffer_head,
-					  (head + 1) &
-						  (CIRCULAR_BUFFER_SIZE - 1));
-		} else {
-			dev_err(&priv->i2c->dev,
-				"Not writing to device as circular buffer would overflow");
+		bytes[ix] = client->read_buffer[(offset + ix) &
+						(client->read_buffer_size - 1)];
+	}
+}
+
+/**
+ * Length of the message at offset in the circular buffer.
+ */
+static size_t st25r391x_message_len(struct st25r391x_client *client,
+				    unsigned long offset)
+{
+	struct nfc_message_header header;
+
+	st25r391x_peek_buffer(client, offset, &header, sizeof(header));
+	return st25r391x_header_len(client) + header.payload_length;
+}
+
+/**
+ * Write a message to the mapped event ring. Client owns tail and may write
+ * anything there, so it is masked and aligned before being used.
+ * Return -ENOSPC if there is not enough room.
+ */
+static int
+st25r391x_write_ring_message(struct st25r391x_client *client,
+			     const struct nfc_message_header_v2 *header,
+			     u16 header_len, const void *payload)
+{
+	struct nfc_event_ring_control *control = client->event_ring;
+	u8 *data = (u8 *)control + PAGE_SIZE;
+	u32 head = client->event_ring_head;
+	u32 tail = smp_load_acquire(&control->tail) &
+		   (NFC_EVENT_RING_SIZE - 1) & ~3;
+	u32 record_len = ALIGN(header_len + header->payload_length, 4);
+	u32 to_end = NFC_EVENT_RING_SIZE - head;
+	u32 needed = record_len > to_end ? to_end + record_len : record_len;
+
+	if (CIRC_SPACE(head, tail, NFC_EVENT_RING_SIZE) < needed) {
+		return -ENOSPC;
+	}
+	if (record_len > to_end) {
+		struct nfc_message_header padding;
+
+		padding.message_type = NFC_EVENT_RING_PADDING_MESSAGE_TYPE;
+		padding.payload_length = to_end - sizeof(padding);
+		memcpy(data + head, &padding, sizeof(padding));
+		head = 0;
+	}
+	memcpy(data + head, header, header_len);
+	memcpy(data + head + header_len, payload, header->payload_length);
+	head = (head + record_len) & (NFC_EVENT_RING_SIZE - 1);
+	client->event_ring_head = head;
+	/* Publish the whole message at once. */
+	smp_store_release(&control->head, head);
+	return 0;
+}
+
+/**
+ * Drop the oldest message of the circular buffer. A partially read message is
+ * kept whole: the message following it is dropped instead, and what remains
+ * of the partial one is moved over it.
+ * Return -ENOSPC if there is no message to drop.
+ */
+static int st25r391x_drop_oldest_message(struct st25r391x_client *client)
+{
+	unsigned long mask = client->read_buffer_size - 1;
+	unsigned long tail = client->read_buffer_tail;
+	size_t remaining = client->read_message_remaining;
+	size_t message_len;
+	size_t ix;
+
+	if (CIRC_CNT(client->read_buffer_head, tail,
+		     client->read_buffer_size) <= remaining) {
+		return -ENOSPC;
+	}
+	message_len = st25r391x_message_len(client, tail + remaining);
+	for (ix = remaining; ix > 0; ix--) {
+		client->read_buffer[(tail + message_len + ix - 1) & mask] =
+			client->read_buffer[(tail + ix - 1) & mask];
+	}
+	client->read_buffer_tail = (tail + message_len) & mask;
+	client->read_buffer_drops++;
+	client->overflow_dropped++;
+	return 0;
+}
+
+/**
+ * Write a message to the circular buffer or to the mapped event ring.
+ * Return -ENOSPC if there is not enough room, even after dropping oldest
+ * messages if overflow policy allows it.
+ * Must be called with producer_lock held.
+ */
+static int st25r391x_enqueue_message(struct st25r391x_client *client,
+				     const struct nfc_message_header_v2 *header,
+				     const void *payload)
+{
+	u16 header_len = st25r391x_header_len(client);
+	u32 message_len = header_len + header->payload_length;
+	unsigned long head;
+
+	if (client->event_ring) {
+		return st25r391x_write_ring_message(client, header, header_len,
+						    payload);
+	}
+	if (message_len >= client->read_buffer_size) {
+		return -ENOSPC;
+	}
+	head = client->read_buffer_head;
+	while (CIRC_SPACE(head, client->read_buffer_tail,
+			  client->read_buffer_size) < message_len) {
+		if (client->overflow_policy !=
+			    NFC_OVERFLOW_POLICY_DROP_OLDEST ||
+		    st25r391x_drop_oldest_message(client) < 0) {
+			return -ENOSPC;
+		}
+	}
+	head = st25r391x_copy_to_buffer(client, head, (const u8 *)header,
+					header_len);
+	head = st25r391x_copy_to_buffer(client, head, payload,
+					header->payload_length);
+	/* Publish the whole message at once. */
+	smp_store_release(&client->read_buffer_head, head);
+	return 0;
+}
+
+/**
+ * Report messages that were dropped or coalesced since last report.
+ * Must be called with producer_lock held.
+ */
+static void st25r391x_enqueue_overflow_message(struct st25r391x_client *client,
+					       u64 timestamp_ns)
+{
+	struct nfc_message_header_v2 header;
+	struct nfc_overflow_message_payload payload;
+
+	header.message_type = NFC_OVERFLOW_MESSAGE_TYPE;
+	header.payload_length = sizeof(payload);
+	header.sequence = client->sequence++;
+	header.timestamp = timestamp_ns;
+	payload.dropped = client->overflow_dropped;
+	payload.coalesced = client->overflow_coalesced;
+	if (st25r391x_enqueue_message(client, &header, &payload) == 0) {
+		// Messages dropped to make room for this one are reported next.
+		client->overflow_dropped -= payload.dropped;
+		client->overflow_coalesced -= payload.coalesced;
+	}
+}
+
+/**
+ * Find the UID of a detected tag message payload of payload_len bytes.
+ * Return its length, or 0 if tag type has no UID or payload is too short.
+ */
+static u8
+st25r391x_detected_tag_uid(const struct nfc_detected_tag_message_payload *tag,
+			   u16 payload_len, const u8 **uid)
+{
+	u8 uid_len;
+
+	switch (tag->tag_type) {
+	case NFC_TAG_TYPE_ISO14443A:
+	case NFC_TAG_TYPE_ISO14443A_T2T:
+	case NFC_TAG_TYPE_MIFARE_CLASSIC:
+	case NFC_TAG_TYPE_ISO14443A_NFCDEP:
+	case NFC_TAG_TYPE_ISO14443A_T4T:
+	case NFC_TAG_TYPE_ISO14443A_T4T_NFCDEP:
+		// Both ISO14443-A tag infos start alike.
+		*uid = tag->tag_info.iso14443a.uid;
+		if (payload_len <
+		    offsetof(struct nfc_detected_tag_message_payload,
+			     tag_info.iso14443a.uid)) {
+			return 0;
+		}
+		uid_len = min_t(u8, tag->tag_info.iso14443a.uid_len,
+				sizeof(tag->tag_info.iso14443a.uid));
+		break;
+
+	case NFC_TAG_TYPE_ISO14443B:
+		*uid = tag->tag_info.iso14443b.pupi;
+		uid_len = sizeof(tag->tag_info.iso14443b.pupi);
+		break;
+
+	case NFC_TAG_TYPE_ST25TB:
+		*uid = tag->tag_info.st25tb.uid;
+		uid_len = sizeof(tag->tag_info.st25tb.uid);
+		break;
+
+	default:
+		return 0;
+	}
+	if (*uid - (const u8 *)tag + uid_len > payload_len) {
+		return 0;
+	}
+	return uid_len;
+}
+
+/**
+ * Determine if a detected tag message is about a tag (same tag type and UID)
+ * for which a detected tag message is queued and was not read yet.
+ * Must be called with producer_lock held.
+ */
+static int st25r391x_is_queued_detection(struct st25r391x_client *client,
+					 u8 message_type, const void *payload,
+					 u16 payload_len)
+{
+	// Prefix of queued payloads holding tag type and UID of any tag.
+	u8 queued[offsetof(struct nfc_detected_tag_message_payload,
+			   tag_info.iso14443a.uid) +
+		  sizeof(((struct nfc_tag_info_iso14443a *)NULL)->uid)];
+	const struct nfc_detected_tag_message_payload *tag = payload;
+	const struct nfc_detected_tag_message_payload *queued_tag =
+		(const struct nfc_detected_tag_message_payload *)queued;
+	struct nfc_message_header header;
+	u16 header_len = st25r391x_header_len(client);
+	unsigned long head = client->read_buffer_head;
+	// Partially read message is no longer queued.
+	unsigned long offset =
+		client->read_buffer_tail + client->read_message_remaining;
+	const u8 *uid;
+	const u8 *queued_uid;
+	u8 uid_len;
+	u16 queued_len;
+
+	if (message_type != NFC_DETECTED_TAG_MESSAGE_TYPE ||
+	    client->event_ring) {
+		return 0;
+	}
+	uid_len = st25r391x_detected_tag_uid(tag, payload_len, &uid);
+	if (uid_len == 0) {
+		return 0;
+	}
+	while (CIRC_CNT(head, offset, client->read_buffer_size) > 0) {
+		st25r391x_peek_buffer(client, offset, &header, sizeof(header));
+		if (header.message_type == NFC_DETECTED_TAG_MESSAGE_TYPE) {
+			queued_len = min_t(u16, header.payload_length,
+					   sizeof(queued));
+			st25r391x_peek_buffer(client, offset + header_len,
+					      queued, queued_len);
+			if (queued_tag->tag_type == tag->tag_type &&
+			    st25r391x_detected_tag_uid(queued_tag, queued_len,
+						       &queued_uid) ==
+				    uid_len &&
+			    memcmp(queued_uid, uid, uid_len) == 0) {
+				return 1;
+			}
+		}
+		offset += header_len + header.payload_length;
+	}
+	return 0;
+}
+
+/**
+ * Notify asynchronous subscribers that a message was queued.
+ */
+static void st25r391x_signal_message(struct st25r391x_client *client,
+				     u8 message_type)
+{
+	kill_fasync(&client->fasync, SIGIO, POLL_IN);
+	if (client->eventfd && message_type < 64 &&
+	    client->eventfd_message_types & BIT_ULL(message_type)) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+		eventfd_signal(client->eventfd);
+#else
+		eventfd_signal(client->eventfd, 1);
+#endif
+	}
+}
+
+/**
+ * Write a message to the queue of a single client.
+ * Must be called with producer_lock held.
+ */
+static void st25r391x_enqueue_client_message(struct st25r391x_client *client,
+					     u8 message_type,
+					     const void *payload,
+					     u16 payload_len, u64 timestamp_ns)
+{
+	struct nfc_message_header_v2 header;
+
+	header.message_type = message_type;
+	header.payload_length = payload_len;
+	header.timestamp = timestamp_ns;
+
+	if (client->overflow_dropped || client->overflow_coalesced) {
+		st25r391x_enqueue_overflow_message(client, timestamp_ns);
+	}
+	// Sequence is incremented for dropped messages as well.
+	header.sequence = client->sequence++;
+	if (st25r391x_enqueue_message(client, &header, payload) == 0) {
+		wake_up_interruptible(&client->read_wq);
+		st25r391x_signal_message(client, message_type);
+	} else if (client->overflow_policy == NFC_OVERFLOW_POLICY_COALESCE &&
+		   st25r391x_is_queued_detection(client, message_type, payload,
+						 payload_len)) {
+		client->overflow_coalesced++;
+	} else {
+		client->overflow_dropped++;
+		dev_err_ratelimited(
+			&client->priv->i2c->dev,
+			"Not writing message %d to device as buffer would overflow",
+			message_type);
+	}
+}
+
+void st25r391x_write_client_message_at(struct st25r391x_i2c_data *priv,
+				       struct st25r391x_client *client,
+				       u8 message_type, const void *payload,
+				       u16 payload_len, u64 timestamp_ns)
+{
+	if (client == NULL) {
+		return;
+	}
+	spin_lock(&priv->producer_lock);
+	st25r391x_enqueue_client_message(client, message_type, payload,
+					 payload_len, timestamp_ns);
+	spin_unlock(&priv->producer_lock);
+}
+
+void st25r391x_write_client_message(struct st25r391x_i2c_data *priv,
+				    struct st25r391x_client *client,
+				    u8 message_type, const void *payload,
+				    u16 payload_len)
+{
+	st25r391x_write_client_message_at(priv, client, message_type, payload,
+					  payload_len, ktime_get_ns());
+}
+
+void st25r391x_broadcast_message_at(struct st25r391x_i2c_data *priv,
+				    u8 message_type, const void *payload,
+				    u16 payload_len, u64 timestamp_ns)
+{
+	struct st25r391x_client *client;
+
+	spin_lock(&priv->producer_lock);
+	list_for_each_entry(client, &priv->clients, list) {
+		st25r391x_enqueue_client_message(client, message_type, payload,
+						 payload_len, timestamp_ns);
+	}
+	spin_unlock(&priv->producer_lock);
+}
+
+void st25r391x_broadcast_message(struct st25r391x_i2c_data *priv,
+				 u8 message_type, const void *payload,
+				 u16 payload_len)
+{
+	st25r391x_broadcast_message_at(priv, message_type, payload,
+				       payload_len, ktime_get_ns());
+}
+
+/**
+ * Copy count bytes from the circular buffer at tail to user space, in at most
+ * two chunks.
+ */
+static int st25r391x_copy_from_buffer(struct st25r391x_client *client,
+				      char __user *buffer, unsigned long tail,
+				      size_t count)
+{
+	size_t chunk = client->read_buffer_size - tail;
+
+	if (chunk > count) {
+		chunk = count;
+	}
+	if (copy_to_user(buffer, &client->read_buffer[tail], chunk)) {
+		return -EFAULT;
+	}
+	if (copy_to_user(buffer + chunk, &client->read_buffer[0],
+			 count - chunk)) {
+		return -EFAULT;
+	}
+	return 0;
+}
+
+int st25r391x_has_message(struct st25r391x_client *client)
+{
+	return smp_load_acquire(&client->read_buffer_head) !=
+	       READ_ONCE(client->read_buffer_tail);
+}
+
+int st25r391x_has_ring_message(struct st25r391x_client *client)
+{
+	struct nfc_event_ring_control *control = READ_ONCE(client->event_ring);
+
+	return control && READ_ONCE(control->head) != READ_ONCE(control->tail);
+}
+
+static int st25r391x_is_client_lagging(struct st25r391x_client *client)
+{
+	struct nfc_event_ring_control *control = READ_ONCE(client->event_ring);
+
+	if (control) {
+		return ((READ_ONCE(control->head) - READ_ONCE(control->tail)) &
+			(NFC_EVENT_RING_SIZE - 1)) > NFC_EVENT_RING_SIZE / 2;
+	}
+	return CIRC_CNT(READ_ONCE(client->read_buffer_head),
+			READ_ONCE(client->read_buffer_tail),
+			client->read_buffer_size) >
+	       client->read_buffer_size / 2;
+}
+
+int st25r391x_is_consumer_lagging(struct st25r391x_i2c_data *priv)
+{
+	struct st25r391x_client *client;
+	int result = 0;
+
+	spin_lock(&priv->producer_lock);
+	list_for_each_entry(client, &priv->clients, list) {
+		result = st25r391x_is_client_lagging(client);
+		if (!result) {
 			break;
 		}
 	}
-	wake_up_interruptible(&priv->read_wq);
 	spin_unlock(&priv->producer_lock);
+	return result;
+}
+
+/**
+ * Length of the message offset bytes after tail, or 0 if it extends past the
+ * available bytes. Messages are read without the lock: when oldest ones are
+ * dropped meanwhile, headers may be overwritten and must not lead to copy
+ * bytes past head, or past the end of the buffer.
+ */
+static size_t st25r391x_queued_message_len(struct st25r391x_client *client,
+					   unsigned long tail, size_t offset,
+					   size_t available)
+{
+	size_t message_len;
+
+	if (available - offset < sizeof(struct nfc_message_header)) {
+		return 0;
+	}
+	message_len = st25r391x_message_len(client, tail + offset);
+	if (message_len > available - offset) {
+		return 0;
+	}
+	return message_len;
+}
+
+/**
+ * Determine how many bytes to copy to a user buffer of len bytes: as many
+ * whole messages as fit, or a part of the next message. Never more than the
+ * available bytes between tail and head.
+ */
+static size_t st25r391x_read_count(struct st25r391x_client *client,
+				   unsigned long head, unsigned long tail,
+				   size_t len, size_t *remaining)
+{
+	size_t available = CIRC_CNT(head, tail, client->read_buffer_size);
+	size_t count = 0;
+	size_t message_len = 0;
+
+	if (*remaining) {
+		// Finish a message that was partially read.
+		count = min3(*remaining, len, available);
+		*remaining -= count;
+		return count;
+	}
+	while (count < available) {
+		message_len = st25r391x_queued_message_len(client, tail, count,
+							   available);
+		if (message_len == 0 || count + message_len > len) {
+			break;
+		}
+		count += message_len;
+	}
+	if (count == 0) {
+		// Compatibility with readers that read the header and the
+		// payload separately.
+		count = min(len, available);
+		*remaining = message_len > count ? message_len - count : 0;
+	}
+	return count;
+}
+
+ssize_t st25r391x_read_messages(struct st25r391x_client *client,
+				char __user *buffer, size_t len)
+{
+	unsigned long head;
+	unsigned long tail;
+	size_t remaining;
+	size_t count;
+	u32 drops;
+
+	if (len == 0) {
+		return 0;
+	}
+	for (;;) {
+		spin_lock(&client->priv->producer_lock);
+		head = client->read_buffer_head;
+		tail = client->read_buffer_tail;
+		remaining = client->read_message_remaining;
+		drops = client->read_buffer_drops;
+		spin_unlock(&client->priv->producer_lock);
+
+		count = st25r391x_read_count(client, head, tail, len,
+					     &remaining);
+		if (st25r391x_copy_from_buffer(client, buffer, tail, count)) {
+			return -EFAULT;
+		}
+
+		spin_lock(&client->priv->producer_lock);
+		if (drops == client->read_buffer_drops) {
+			client->read_message_remaining = remaining;
+			client->read_buffer_tail = (tail + count) &
+						 (client->read_buffer_size - 1);
+			spin_unlock(&client->priv->producer_lock);
+			return count;
+		}
+		// Oldest messages were dropped and possibly overwritten while
+		// they were copied, start over.
+		spin_unlock(&client->priv->producer_lock);
+	}
+}
+
+u32 st25r391x_message_count(struct st25r391x_client *client, u32 max_count)
+{
+	unsigned long head;
+	unsigned long tail;
+	u32 count = 0;
+
+	spin_lock(&client->priv->producer_lock);
+	head = client->read_buffer_head;
+	tail = client->read_buffer_tail;
+	while (count < max_count &&
+	       CIRC_CNT(head, tail, client->read_buffer_size) > 0) {
+		tail = (tail + st25r391x_message_len(client, tail)) &
+		       (client->read_buffer_size - 1);
+		count++;
+	}
+	spin_unlock(&client->priv->producer_lock);
+	return count;
+}
+
+ssize_t st25r391x_read_message_slots(struct st25r391x_client *client,
+				     char __user *slots, u32 slot_size,
+				     u32 max_count)
+{
+	unsigned long tail;
+	size_t available;
+	size_t offset;
+	size_t message_len;
+	u32 count;
+	u32 drops;
+
+	for (;;) {
+		spin_lock(&client->priv->producer_lock);
+		tail = client->read_buffer_tail;
+		available = CIRC_CNT(client->read_buffer_head, tail,
+				     client->read_buffer_size);
+		drops = client->read_buffer_drops;
+		spin_unlock(&client->priv->producer_lock);
+
+		count = 0;
+		offset = 0;
+		while (count < max_count && offset < available) {
+			message_len = st25r391x_queued_message_len(
+				client, tail, offset, available);
+			if (message_len == 0) {
+				break;
+			}
+			if (st25r391x_copy_from_buffer(
+				    client, slots + (size_t)count * slot_size,
+				    (tail + offset) &
+					    (client->read_buffer_size - 1),
+				    min_t(size_t, message_len, slot_size))) {
+				return -EFAULT;
+			}
+			offset += message_len;
+			count++;
+		}
+
+		spin_lock(&client->priv->producer_lock);
+		if (drops == client->read_buffer_drops) {
+			client->read_buffer_tail = (tail + offset) &
+						 (client->read_buffer_size - 1);
+			spin_unlock(&client->priv->producer_lock);
+			return count;
+		}
+		// Oldest messages were dropped while they were copied, start
+		// over.
+		spin_unlock(&client->priv->producer_lock);
+	}
 }
@@ -26,7 +26,28 @@
 
 #include "st25r391x.h"
 
-void st25r391x_write_to_device(struct st25r391x_i2c_data *priv, const u8 *data,
-			       int count);
+void st25r391x_write_client_message_at(struct st25r391x_i2c_data *priv,
+				       struct st25r391x_client *client,
+				       u8 message_type, const void *payload,
+				       u16 payload_len, u64 timestamp_ns);
+void st25r391x_write_client_message(struct st25r391x_i2c_data *priv,
+				    struct st25r391x_client *client,
+				    u8 message_type, const void *payload,
+				    u16 payload_len);
+void st25r391x_broadcast_message_at(struct st25r391x_i2c_data *priv,
+				    u8 message_type, const void *payload,
+				    u16 payload_len, u64 timestamp_ns);
+void st25r391x_broadcast_message(struct st25r391x_i2c_data *priv,
+				 u8 message_type, const void *payload,
+				 u16 payload_len);
+int st25r391x_has_message(struct st25r391x_client *client);
+int st25r391x_has_ring_message(struct st25r391x_client *client);
+int st25r391x_is_consumer_lagging(struct st25r391x_i2c_data *priv);
+ssize_t st25r391x_read_messages(struct st25r391x_client *client,
+				char __user *buffer, size_t len);
+u32 st25r391x_message_count(struct st25r391x_client *client, u32 max_count);
+ssize_t st25r391x_read_message_slots(struct st25r391x_client *client,
+				     char __user *slots, u32 slot_size,
+				     u32 max_count);
 
 #endif
@@ -24,11 +24,22 @@
 #include "st25r391x_i2c.h"
 #include "st25r391x_commands.h"
 #include "st25r391x_registers.h"
+#include "st25r391x.h"
+
+void st25r391x_count_i2c_transaction(struct i2c_client *i2c)
+{
+	struct st25r391x_i2c_data *priv = i2c_get_clientdata(i2c);
+
+	// Client data is only set once chip is configured in probe.
+	if (priv)
+		priv->power_stats.i2c_transactions++;
+}
 
 s32 st25r391x_read_register_byte(struct i2c_client *i2c, u8 reg)
 {
 	s32 result;
 	do {
+		st25r391x_count_i2c_transaction(i2c);
 		result = i2c_smbus_read_byte_data(
 			i2c, reg | ST25R391X_REGISTER_READ_MODE);
 		if (result < 0) {
@@ -41,11 +52,44 @@ s32 st25r391x_read_register_byte(struct i2c_client *i2c, u8 reg)
 	return result;
 }
 
+s32 st25r391x_read_bank_b_register_byte(struct i2c_client *i2c, u8 reg)
+{
+	s32 result;
+	u8 command[2];
+	u8 value;
+	struct i2c_msg msgs[2];
+
+	command[0] = ST25R391X_REGISTER_SPACE_B_ACCESS_COMMAND_CODE;
+	command[1] = reg | ST25R391X_REGISTER_READ_MODE;
+	msgs[0].addr = i2c->addr;
+	msgs[0].flags = 0;
+	msgs[0].len = sizeof(command);
+	msgs[0].buf = command;
+	msgs[1].addr = i2c->addr;
+	msgs[1].flags = I2C_M_RD;
+	msgs[1].len = 1;
+	msgs[1].buf = &value;
+	do {
+		st25r391x_count_i2c_transaction(i2c);
+		result = i2c_transfer(i2c->adapter, msgs, 2);
+		if (result < 0) {
+			struct device *dev = &i2c->dev;
+			dev_err(dev,
+				"st25r391x_read_bank_b_register_byte: could not read register %.02hhXh (%d)",
+				reg, result);
+			break;
+		}
+		result = value;
+	} while (0);
+	return result;
+}
+
 s32 st25r391x_read_registers_u16(struct i2c_client *i2c, u8 first_reg)
 {
 	s32 result;
 	do {
 		u8 buffer[2];
+		st25r391x_count_i2c_transaction(i2c);
 		result = i2c_smbus_read_i2c_block_data(
 			i2c, first_reg | ST25R391X_REGISTER_READ_MODE, 2,
 			buffer);
@@ -66,6 +110,7 @@ s32 st25r391x_write_register_byte_check(struct i2c_client *i2c, u8 reg,
 {
 	int result;
 	do {
+		st25r391x_count_i2c_transaction(i2c);
 		result = i2c_smbus_write_byte_data(
 			i2c, reg | ST25R391X_REGISTER_WRITE_MODE, value);
 		if (result < 0) {
@@ -76,6 +121,7 @@ s32 st25r391x_write_register_byte_check(struct i2c_client *i2c, u8 reg,
 			break;
 		}
 
+		st25r391x_count_i2c_transaction(i2c);
 		result = i2c_smbus_read_byte_data(
 			i2c, reg | ST25R391X_REGISTER_READ_MODE);
 		if (result < 0) {
@@ -113,6 +159,7 @@ s32 st25r391x_write_registers_check(struct i2c_client *i2c, u8 first_reg,
 	}
 	va_end(ap);
 	do {
+		st25r391x_count_i2c_transaction(i2c);
 		result = i2c_smbus_write_i2c_block_data(
 			i2c, first_reg | ST25R391X_REGISTER_WRITE_MODE, count,
 			buffer);
@@ -124,6 +171,7 @@ s32 st25r391x_write_registers_check(struct i2c_client *i2c, u8 first_reg,
 			break;
 		}
 
+		st25r391x_count_i2c_transaction(i2c);
 		result = i2c_smbus_read_i2c_block_data(
 			i2c, first_reg | ST25R391X_REGISTER_READ_MODE, count,
 			check_buffer);
@@ -164,6 +212,7 @@ s32 st25r391x_write_bank_b_registers(struct i2c_client *i2c, u8 first_reg,
 	va_end(ap);
 	buffer[0] = first_reg;
 	do {
+		st25r391x_count_i2c_transaction(i2c);
 		result = i2c_smbus_write_i2c_block_data(
 			i2c, ST25R391X_REGISTER_SPACE_B_ACCESS_COMMAND_CODE,
 			count + 1, buffer);
@@ -183,6 +232,7 @@ static s32 st25r391x_set_or_clear_register_bits(struct i2c_client *i2c, u8 reg,
 {
 	s32 result;
 	do {
+		st25r391x_count_i2c_transaction(i2c);
 		result = i2c_smbus_read_byte_data(
 			i2c, reg | ST25R391X_REGISTER_READ_MODE);
 		if (result < 0) {
@@ -193,6 +243,7 @@ static s32 st25r391x_set_or_clear_register_bits(struct i2c_client *i2c, u8 reg,
 			break;
 		}
 
+		st25r391x_count_i2c_transaction(i2c);
 		result = i2c_smbus_write_byte_data(
 			i2c, reg | ST25R391X_REGISTER_WRITE_MODE,
 			set ? result | value : result & ~value);
@@ -221,6 +272,7 @@ s32 st25r391x_direct_command(struct i2c_client *i2c, u8 cmd)
 {
 	s32 result;
 	do {
+		st25r391x_count_i2c_transaction(i2c);
 		result = i2c_smbus_read_byte_data(
 			i2c, cmd | ST25R391X_DIRECT_COMMAND_MODE);
 		if (result < 0) {
@@ -238,6 +290,7 @@ s32 st25r391x_load_fifo(struct i2c_client *i2c, u16 len, const u8 *data)
 {
 	s32 result;
 	do {
+		st25r391x_count_i2c_transaction(i2c);
 		result = i2c_smbus_read_word_data(
 			i2c, ST25R391X_FIFO_STATUS_1_REGISTER |
 				     ST25R391X_REGISTER_READ_MODE);
@@ -257,6 +310,7 @@ s32 st25r391x_load_fifo(struct i2c_client *i2c, u16 len, const u8 *data)
 			break;
 		}
 
+		st25r391x_count_i2c_transaction(i2c);
 		result = i2c_smbus_write_i2c_block_data(
 			i2c, ST25R391X_FIFO_LOAD_MODE, len, data);
 		if (result < 0) {
@@ -267,6 +321,7 @@ s32 st25r391x_load_fifo(struct i2c_client *i2c, u16 len, const u8 *data)
 			break;
 		}
 
+		st25r391x_count_i2c_transaction(i2c);
 		result = i2c_smbus_read_word_data(
 			i2c, ST25R391X_FIFO_STATUS_1_REGISTER |
 				     ST25R391X_REGISTER_READ_MODE);
@@ -295,6 +350,7 @@ s32 st25r391x_read_fifo(struct i2c_client *i2c, u16 max_len, u8 *data,
 	s32 result;
 	s32 count;
 	do {
+		st25r391x_count_i2c_transaction(i2c);
 		result = i2c_smbus_read_word_data(
 			i2c, ST25R391X_FIFO_STATUS_1_REGISTER |
 				     ST25R391X_REGISTER_READ_MODE);
@@ -324,6 +380,7 @@ s32 st25r391x_read_fifo(struct i2c_client *i2c, u16 max_len, u8 *data,
 			break;
 		}
 
+		st25r391x_count_i2c_transaction(i2c);
 		result = i2c_smbus_read_i2c_block_data(
 			i2c, ST25R391X_FIFO_READ_MODE, count, data);
 		if (result < 0) {
@@ -24,7 +24,9 @@
 
 #include <linux/i2c.h>
 
+void st25r391x_count_i2c_transaction(struct i2c_client *i2c);
 s32 st25r391x_read_register_byte(struct i2c_client *i2c, u8 reg);
+s32 st25r391x_read_bank_b_register_byte(struct i2c_client *i2c, u8 reg);
 s32 st25r391x_read_registers_u16(struct i2c_client *i2c,
 				 u8 first_reg); // first register is msb
 s32 st25r391x_write_register_byte_check(struct i2c_client *i2c, u8 reg,
@@ -25,6 +25,7 @@
 #include <linux/timekeeping.h>
 
 #include "st25r391x_commands.h"
+#include "st25r391x_i2c.h"
 #include "st25r391x_registers.h"
 
 void st25r391x_clear_interrupts(struct st25r391x_interrupts *ints, u8 main_mask,
@@ -45,10 +46,10 @@ void st25r391x_clear_interrupts(struct st25r391x_interrupts *ints, u8 main_mask,
 int st25r391x_polling_wait_for_interrupt_bit(
 	struct i2c_client *i2c, struct st25r391x_interrupts *ints, u8 main_mask,
 	u8 timer_and_nfc_mask, u8 error_and_wakeup_mask, u8 passive_target_mask,
-	u16 timeout_usec)
+	u32 timeout_usec)
 {
 	int sleep_min = timeout_usec >= 2000 ? 1000 : timeout_usec / 2;
-	u64 timeout_ktime_ns = ktime_get_ns() + (timeout_usec * 1000);
+	u64 timeout_ktime_ns = ktime_get_ns() + (u64)timeout_usec * 1000;
 	u8 masks[4];
 	u8 base_addr = ST25R391X_MAIN_INTERRUPT_REGISTER;
 	u8 count = 4;
@@ -82,22 +83,29 @@ int st25r391x_polling_wait_for_interrupt_bit(
 	}
 	count -= start_index;
 
-	do {
+	for (;;) {
 		for (ix = start_index; ix < start_index + count; ix++) {
 			if (masks[ix] & ints->flags[ix]) {
+				ints->timestamp_ns = ktime_get_ns();
 				return 0;
 			}
 		}
+		// Flags read last are checked above even if the deadline passed
+		// while reading them.
+		if (ktime_get_ns() >= timeout_ktime_ns) {
+			break;
+		}
 		usleep_range(sleep_min, sleep_min * 2);
 		do {
 			// Busy loop on bus
+			st25r391x_count_i2c_transaction(i2c);
 			result = i2c_smbus_read_i2c_block_data(
 				i2c,
 				(base_addr + start_index) |
 					ST25R391X_REGISTER_READ_MODE,
 				count, ints->flags + start_index);
 		} while (result < 0 && ktime_get_ns() < timeout_ktime_ns);
-	} while (ktime_get_ns() < timeout_ktime_ns);
+	}
 
 	return -1;
 }
@@ -26,6 +26,7 @@
 
 struct st25r391x_interrupts {
 	u8 flags[4];
+	u64 timestamp_ns; // when an awaited interrupt was last found set
 };
 
 void st25r391x_clear_interrupts(struct st25r391x_interrupts *ints, u8 main_mask,
@@ -34,6 +35,6 @@ void st25r391x_clear_interrupts(struct st25r391x_interrupts *ints, u8 main_mask,
 int st25r391x_polling_wait_for_interrupt_bit(
 	struct i2c_client *i2c, struct st25r391x_interrupts *ints, u8 main_mask,
 	u8 timer_and_nfc_mask, u8 error_and_wakeup_mask, u8 passive_target_mask,
-	u16 timeout_usec);
+	u32 timeout_usec);
 
 #endif
@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: GPL-2.0+ WITH Linux-syscall-note */
+/*
+ * ST25R3916/7 NFC Reader Driver
+ *
+ * Copyright (C) 2020-2022 Paul Guyot <pguyot@kallisys.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA
+ */
+
+
+#include <linux/list.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+
+#include "st25r391x_listener.h"
+
+static LIST_HEAD(st25r391x_listeners);
+// Held while notifying, so listeners are not unregistered in the meantime.
+static DEFINE_MUTEX(st25r391x_listeners_lock);
+
+struct st25r391x_listener_work {
+	struct work_struct work;
+	struct st25r391x_listener *listener;
+	struct st25r391x_tag_event event;
+};
+
+int st25r391x_register_listener(struct st25r391x_listener *listener)
+{
+	if (listener->notify == NULL) {
+		return -EINVAL;
+	}
+	mutex_lock(&st25r391x_listeners_lock);
+	list_add_tail(&listener->list, &st25r391x_listeners);
+	mutex_unlock(&st25r391x_listeners_lock);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(st25r391x_register_listener);
+
+void st25r391x_unregister_listener(struct st25r391x_listener *listener)
+{
+	mutex_lock(&st25r391x_listeners_lock);
+	list_del(&listener->list);
+	mutex_unlock(&st25r391x_listeners_lock);
+	// Wait for events queued before it was unregistered.
+	if (listener->workqueue) {
+		flush_workqueue(listener->workqueue);
+	}
+}
+EXPORT_SYMBOL_GPL(st25r391x_unregister_listener);
+
+static void st25r391x_listener_work_fn(struct work_struct *work)
+{
+	struct st25r391x_listener_work *listener_work =
+		container_of(work, struct st25r391x_listener_work, work);
+
+	listener_work->listener->notify(listener_work->listener,
+					&listener_work->event);
+	kfree(listener_work);
+}
+
+void st25r391x_notify_listeners(const struct st25r391x_tag_event *event)
+{
+	struct st25r391x_listener *listener;
+	struct st25r391x_listener_work *listener_work;
+
+	mutex_lock(&st25r391x_listeners_lock);
+	list_for_each_entry(listener, &st25r391x_listeners, list) {
+		if (listener->workqueue == NULL) {
+			listener->notify(listener, event);
+			continue;
+		}
+		listener_work = kmalloc(sizeof(*listener_work), GFP_KERNEL);
+		if (listener_work == NULL) {
+			continue;
+		}
+		INIT_WORK(&listener_work->work, st25r391x_listener_work_fn);
+		listener_work->listener = listener;
+		listener_work->event = *event;
+		queue_work(listener->workqueue, &listener_work->work);
+	}
+	mutex_unlock(&st25r391x_listeners_lock);
+}
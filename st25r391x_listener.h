@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: GPL-2.0+ WITH Linux-syscall-note */
+/*
+ * ST25R3916/7 NFC Reader Driver
+ *
+ * Copyright (C) 2020-2022 Paul Guyot <pguyot@kallisys.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA
+ */
+
+
+#ifndef ST25R391X_LISTENER_H
+#define ST25R391X_LISTENER_H
+
+// API for other kernel modules to react to tag events of every reader,
+// without a userspace client.
+
+#include <linux/list.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+#include "nfc.h"
+
+enum st25r391x_tag_event_type {
+	st25r391x_tag_detected = NFC_GENL_CMD_TAG_DETECTED,
+	st25r391x_tag_selected = NFC_GENL_CMD_TAG_SELECTED,
+	st25r391x_tag_departed = NFC_GENL_CMD_TAG_DEPARTED,
+};
+
+struct st25r391x_tag_event {
+	enum st25r391x_tag_event_type type;
+	dev_t reader; // device number of the reader
+	u64 timestamp_ns; // CLOCK_MONOTONIC
+	u8 tag_type; // NFC_TAG_TYPE_*
+	u8 uid_len;
+	u8 uid[10];
+	u16 tag_info_len; // 0 for departed tags
+	struct nfc_detected_tag_message_payload tag_info;
+};
+
+struct st25r391x_listener {
+	// Called for every tag event. Event is only valid during the call.
+	void (*notify)(struct st25r391x_listener *listener,
+		       const struct st25r391x_tag_event *event);
+	// Workqueue to call notify from, or NULL to call it from the polling
+	// work, where it delays polling and must not unregister listeners.
+	struct workqueue_struct *workqueue;
+	struct list_head list; // private
+};
+
+// Listeners can be registered and unregistered at any time, including while
+// readers poll. Once st25r391x_unregister_listener returns, notify is no
+// longer called, so it must not be called from listener's workqueue.
+int st25r391x_register_listener(struct st25r391x_listener *listener);
+void st25r391x_unregister_listener(struct st25r391x_listener *listener);
+
+// Driver side.
+void st25r391x_notify_listeners(const struct st25r391x_tag_event *event);
+
+#endif
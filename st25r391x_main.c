@@ -31,10 +31,19 @@
 #include <linux/sched.h>
 #include <linux/wait.h>
 #include <linux/uaccess.h>
+#include <linux/uio.h>
 #include <linux/poll.h>
 #include <linux/delay.h>
 #include <linux/i2c.h>
 #include <linux/circ_buf.h>
+#include <linux/eventfd.h>
+#include <linux/mm.h>
+#include <linux/pm_runtime.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+#include <linux/io_uring/cmd.h>
+#endif
 #include <stdarg.h>
 
 #include "st25r391x.h"
@@ -44,14 +53,26 @@
 #include "st25r391x_dev.h"
 #include "st25r391x_i2c.h"
 #include "st25r391x_interrupts.h"
+#include "st25r391x_listener.h"
+#include "st25r391x_netlink.h"
 #include "st25r391x_nfca.h"
 #include "st25r391x_nfcb.h"
 #include "st25r391x_nfcf.h"
+#include "st25r391x_prescreen.h"
 #include "st25r391x_registers.h"
 #include "st25r391x_st25tb.h"
+#include "st25r391x_wakeup.h"
 
 #include "nfc.h"
 
+// Timer helpers were renamed, and older names later removed.
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+#define timer_delete_sync del_timer_sync
+#endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 16, 0)
+#define timer_container_of from_timer
+#endif
+
 // ========================================================================== //
 // PROTOCOL
 // ========================================================================== //
@@ -70,6 +91,56 @@
 // Polling interval
 #define POLLING_TIMEOUT_SECS_DIV 100
 
+// Parameters
+
+static unsigned int read_buffer_size = CIRCULAR_BUFFER_SIZE;
+module_param(read_buffer_size, uint, 0644);
+MODULE_PARM_DESC(
+	read_buffer_size,
+	"Default size of the buffer of messages from driver, in bytes (rounded up to a power of two)");
+
+static unsigned int oscillator_idle_ms = 100;
+module_param(oscillator_idle_ms, uint, 0644);
+MODULE_PARM_DESC(
+	oscillator_idle_ms,
+	"Time the oscillator is kept on after the field is turned off, in milliseconds (0 to turn it off with the field)");
+
+static unsigned int regulator_interval_ms = 60000;
+module_param(regulator_interval_ms, uint, 0644);
+MODULE_PARM_DESC(
+	regulator_interval_ms,
+	"Time a regulator calibration is reused, in milliseconds (0 to adjust regulators at every field on)");
+
+static unsigned int supply_drift_mv = 100;
+module_param(supply_drift_mv, uint, 0644);
+MODULE_PARM_DESC(
+	supply_drift_mv,
+	"Power supply drift triggering regulator calibration, in millivolts (0 to ignore supply drift)");
+
+static unsigned int select_field_on_ms = 1000;
+module_param(select_field_on_ms, uint, 0644);
+MODULE_PARM_DESC(
+	select_field_on_ms,
+	"Time the field is kept on while looking for an ISO14443-A tag to select, in milliseconds (0 to turn it off after every attempt)");
+
+static unsigned int wake_up_interval_ms = 100;
+module_param(wake_up_interval_ms, uint, 0644);
+MODULE_PARM_DESC(
+	wake_up_interval_ms,
+	"Interval of antenna measurements in low power wake-up mode, in milliseconds (10 to 800)");
+
+static unsigned int autosuspend_ms = 1000;
+module_param(autosuspend_ms, uint, 0444);
+MODULE_PARM_DESC(
+	autosuspend_ms,
+	"Time the reader is idle before the chip is powered down, in milliseconds (see also power/autosuspend_delay_ms)");
+
+static bool reader_only;
+module_param(reader_only, bool, 0444);
+MODULE_PARM_DESC(
+	reader_only,
+	"Disable external field detection and turn field on without collision avoidance");
+
 // Prototypes
 
 static void st25r391x_polling_timer_cb(struct timer_list *t);
@@ -81,44 +152,301 @@ static int st25r391x_release(struct inode *inode, struct file *file);
 static ssize_t st25r391x_read(struct file *file, char __user *buffer,
 			      size_t len, loff_t *offset);
 static unsigned int st25r391x_poll(struct file *file, poll_table *wait);
+static int st25r391x_mmap(struct file *file, struct vm_area_struct *vma);
+static int st25r391x_fasync(int fd, struct file *file, int on);
 static long st25r391x_unlocked_ioctl(struct file *file, unsigned int,
 				     unsigned long);
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+static int st25r391x_i2c_probe(struct i2c_client *i2c);
+#else
 static int st25r391x_i2c_probe(struct i2c_client *i2c,
 			       const struct i2c_device_id *id);
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 1, 0)
+static void st25r391x_i2c_remove(struct i2c_client *client);
+#else
 static int st25r391x_i2c_remove(struct i2c_client *client);
+#endif
 
 // ========================================================================== //
 // Polling code
 // ========================================================================== //
 
-static void st25r391x_transition_to_idle(struct st25r391x_i2c_data *priv)
+/**
+ * Report a change of external field presence to clients.
+ */
+static void st25r391x_external_field(struct st25r391x_i2c_data *priv,
+				     bool present)
+{
+	struct nfc_external_field_message_payload payload;
+
+	if (priv->external_field == present)
+		return;
+	priv->external_field = present;
+	payload.present = present;
+	st25r391x_broadcast_message(priv, NFC_EXTERNAL_FIELD_MESSAGE_TYPE,
+				    &payload, sizeof(payload));
+}
+
+/**
+ * Determine if polling should back off because of an external field.
+ * Once collision avoidance found one, the oscillator is kept on and presence
+ * is followed with the external field detector, with a single register read.
+ */
+static bool st25r391x_external_field_backoff(struct st25r391x_i2c_data *priv)
+{
+	s32 result;
+
+	if (!priv->external_field)
+		return false;
+	if (priv->oscillator_on) {
+		result = st25r391x_read_register_byte(
+			priv->i2c, ST25R391X_AUXILIARY_DISPLAY_REGISTER);
+		if (result >= 0 &&
+		    result & ST25R391X_AUXILIARY_DISPLAY_REGISTER_efd_o) {
+			priv->power_stats.external_field_backoffs++;
+			return true;
+		}
+	}
+	st25r391x_external_field(priv, false);
+	return false;
+}
+
+/**
+ * Return the guard time after field on, the longest of the technologies about
+ * to be polled.
+ */
+static u32 st25r391x_field_guard_time_usec(struct st25r391x_i2c_data *priv)
+{
+	u64 protocols;
+	u32 guard_time_usec = 0;
+
+	if (priv->mode == mode_select) {
+		protocols = 1ULL << priv->mode_params->select.tag_id.tag_type;
+	} else {
+		protocols = priv->mode_params->discover.protocols;
+	}
+	if (protocols &
+	    (NFC_TAG_PROTOCOL_ISO14443A | NFC_TAG_PROTOCOL_ISO14443A_T2T |
+	     NFC_TAG_PROTOCOL_MIFARE_CLASSIC |
+	     NFC_TAG_PROTOCOL_ISO14443A_NFCDEP | NFC_TAG_PROTOCOL_ISO14443A4 |
+	     NFC_TAG_PROTOCOL_ISO14443A_T4T |
+	     NFC_TAG_PROTOCOL_ISO14443A_T4T_NFCDEP)) {
+		guard_time_usec = ST25R391X_NFCA_GUARD_TIME_USEC;
+	}
+	if (protocols &
+	    (NFC_TAG_PROTOCOL_ISO14443B | NFC_TAG_PROTOCOL_ST25TB)) {
+		guard_time_usec =
+			max_t(u32, guard_time_usec,
+			      ST25R391X_NFCB_GUARD_TIME_USEC);
+	}
+	if (protocols &
+	    (NFC_TAG_PROTOCOL_NFCF | NFC_TAG_PROTOCOL_NFCF_NFCDEP)) {
+		guard_time_usec =
+			max_t(u32, guard_time_usec,
+			      ST25R391X_NFCF_GUARD_TIME_USEC);
+	}
+	return guard_time_usec;
+}
+
+/**
+ * Turn field on, reusing regulator calibration if it is recent enough.
+ */
+static s32 st25r391x_field_on(struct st25r391x_i2c_data *priv)
+{
+	s32 result;
+
+	result = st25r391x_turn_field_on(
+		priv, msecs_to_jiffies(READ_ONCE(regulator_interval_ms)),
+		READ_ONCE(supply_drift_mv),
+		st25r391x_field_guard_time_usec(priv));
+	if (result == -EBUSY)
+		st25r391x_external_field(priv, true);
+	return result;
+}
+
+/**
+ * Turn field off, and the oscillator once it has been idle long enough.
+ */
+static void st25r391x_field_off(struct st25r391x_i2c_data *priv)
+{
+	unsigned int idle_ms = READ_ONCE(oscillator_idle_ms);
+
+	(void)st25r391x_turn_field_off(priv);
+	// External field detector needs the oscillator.
+	if (idle_ms == 0 && !priv->external_field) {
+		(void)st25r391x_power_down(priv);
+	} else if (priv->oscillator_on) {
+		mod_delayed_work(system_wq, &priv->oscillator_off_work,
+				 msecs_to_jiffies(idle_ms));
+	}
+}
+
+static void st25r391x_oscillator_off(struct work_struct *work)
+{
+	struct st25r391x_i2c_data *priv =
+		container_of(to_delayed_work(work), struct st25r391x_i2c_data,
+			     oscillator_off_work);
+
+	mutex_lock(&priv->command_lock);
+	if (!priv->field_on && priv->oscillator_on && !priv->external_field) {
+		(void)st25r391x_power_down(priv);
+	}
+	mutex_unlock(&priv->command_lock);
+}
+
+/**
+ * Hold the chip active while reader is not idle.
+ */
+static void st25r391x_leave_idle(struct st25r391x_i2c_data *priv)
+{
+	struct device *dev = &priv->i2c->dev;
+
+	if (priv->mode != mode_idle)
+		return;
+	// Usage count is incremented even on failure, and decremented when
+	// entering idle mode again.
+	if (pm_runtime_get_sync(dev) < 0) {
+		dev_err(priv->device,
+			"st25r391x_leave_idle: Failed to resume chip");
+	}
+	if (READ_ONCE(priv->chip_reset)) {
+		WRITE_ONCE(priv->chip_reset, false);
+		priv->regulator.valid = 0;
+		priv->field_guard_timer_valid = 0;
+	}
+}
+
+static void st25r391x_enter_idle(struct st25r391x_i2c_data *priv)
 {
-	struct nfc_message_header idle_response_header;
+	struct device *dev = &priv->i2c->dev;
+
+	if (priv->mode != mode_idle) {
+		pm_runtime_mark_last_busy(dev);
+		pm_runtime_put_autosuspend(dev);
+	}
+}
 
+static void st25r391x_transition_to_idle(struct st25r391x_i2c_data *priv)
+{
+	// Presence is no longer followed.
+	priv->external_field = 0;
 	if (priv->field_on) {
-		(void)st25r391x_turn_field_off(priv);
+		st25r391x_field_off(priv);
+	} else if (priv->wakeup.enabled) {
+		(void)st25r391x_power_down(priv);
 	}
 
+	st25r391x_enter_idle(priv);
 	priv->mode = mode_idle;
-	idle_response_header.message_type =
-		NFC_IDLE_MODE_ACKNOWLEDGE_MESSAGE_TYPE;
-	idle_response_header.payload_length = 0;
-	st25r391x_write_to_device(priv, (const u8 *)&idle_response_header,
-				  sizeof(idle_response_header));
+	st25r391x_write_client_message(priv, priv->lease,
+				       NFC_IDLE_MODE_ACKNOWLEDGE_MESSAGE_TYPE,
+				       NULL, 0);
+	priv->lease = NULL;
 	stop_polling_timer(priv);
 }
 
+static u16 st25r391x_tx_bytes_count(u16 tx_count, u8 flags)
+{
+	if (flags & NFC_TRANSCEIVE_FLAGS_BITS) {
+		return (tx_count + 7) >> 3;
+	}
+	return tx_count;
+}
+
+/**
+ * Report a tag event to netlink subscribers and in-kernel listeners.
+ */
+static void st25r391x_tag_event(struct st25r391x_i2c_data *priv,
+				enum st25r391x_tag_event_type type,
+				u8 tag_type, const u8 *uid, u8 uid_len,
+				const void *tag_info, u16 tag_info_len,
+				u64 timestamp_ns)
+{
+	struct st25r391x_tag_event event;
+
+	st25r391x_netlink_tag_event(priv, type, tag_type, uid, uid_len,
+				    tag_info, tag_info_len, timestamp_ns);
+
+	event.type = type;
+	event.reader = priv->chrdev;
+	event.timestamp_ns = timestamp_ns;
+	event.tag_type = tag_type;
+	event.uid_len = min_t(u8, uid_len, sizeof(event.uid));
+	memcpy(event.uid, uid, event.uid_len);
+	event.tag_info_len = 0;
+	if (tag_info) {
+		event.tag_info_len =
+			min_t(u16, tag_info_len, sizeof(event.tag_info));
+		memcpy(&event.tag_info, tag_info, event.tag_info_len);
+	}
+	st25r391x_notify_listeners(&event);
+}
+
+/**
+ * Record a tag found by discovery during current polling cycle.
+ */
+static void st25r391x_tag_found(struct st25r391x_i2c_data *priv, u8 tag_type,
+				u8 cid, const u8 *uid, u8 uid_len)
+{
+	struct st25r391x_tag_id *tag_id;
+	int ix;
+
+	for (ix = 0; ix < priv->present_tags_count; ix++) {
+		tag_id = &priv->present_tags[ix];
+		if (tag_id->tag_type == tag_type &&
+		    tag_id->uid_len == uid_len &&
+		    memcmp(tag_id->uid, uid, uid_len) == 0) {
+			priv->present_tags_found |= 1 << ix;
+			return;
+		}
+	}
+	if (priv->present_tags_count < MAX_PRESENT_TAGS) {
+		tag_id = &priv->present_tags[priv->present_tags_count];
+		tag_id->tag_type = tag_type;
+		tag_id->cid = cid;
+		tag_id->uid_len = uid_len;
+		memcpy(tag_id->uid, uid, uid_len);
+		priv->present_tags_found |= 1 << priv->present_tags_count;
+		priv->present_tags_count++;
+	}
+}
+
+/**
+ * Report tags found during previous polling cycle but not during this one.
+ */
+static void st25r391x_report_departed_tags(struct st25r391x_i2c_data *priv)
+{
+	u64 timestamp_ns = ktime_get_ns();
+	struct st25r391x_tag_id *tag_id;
+	int kept = 0;
+	int ix;
+
+	for (ix = 0; ix < priv->present_tags_count; ix++) {
+		tag_id = &priv->present_tags[ix];
+		if (priv->present_tags_found & (1 << ix)) {
+			priv->present_tags[kept++] = *tag_id;
+		} else {
+			st25r391x_tag_event(priv, st25r391x_tag_departed,
+					    tag_id->tag_type, tag_id->uid,
+					    tag_id->uid_len, NULL, 0,
+					    timestamp_ns);
+		}
+	}
+	priv->present_tags_count = kept;
+}
+
 void st25r391x_process_selected_tag(
 	struct st25r391x_i2c_data *priv,
-	const struct nfc_detected_tag_message_payload *tag_payload, u8 cid)
+	const struct nfc_detected_tag_message_payload *tag_payload, u8 cid,
+	u32 fwt_usec)
 {
 	u16 payload_len;
 	const u8 *uid;
 	u8 uid_len;
-	struct nfc_message_header detected_tag_message_header;
 	int select_tag = priv->mode == mode_select ||
-			 priv->mode_params.discover.flags &
+			 priv->mode_params->discover.flags &
 				 NFC_DISCOVER_FLAGS_SELECT;
 
 	switch (tag_payload->tag_type) {
@@ -159,30 +487,45 @@ void st25r391x_process_selected_tag(
 		break;
 	}
 
-	detected_tag_message_header.message_type =
-		select_tag ? NFC_SELECTED_TAG_MESSAGE_TYPE :
-				   NFC_DETECTED_TAG_MESSAGE_TYPE;
-	detected_tag_message_header.payload_length = payload_len;
-	st25r391x_write_to_device(priv,
-				  (const u8 *)&detected_tag_message_header,
-				  sizeof(detected_tag_message_header));
-	st25r391x_write_to_device(priv, (const u8 *)tag_payload, payload_len);
+	// Every client is told about detected tags, selected tags are only
+	// reported to the client owning the reader.
+	if (select_tag) {
+		st25r391x_write_client_message_at(
+			priv, priv->lease, NFC_SELECTED_TAG_MESSAGE_TYPE,
+			tag_payload, payload_len, priv->ints.timestamp_ns);
+	} else {
+		st25r391x_broadcast_message_at(priv,
+					       NFC_DETECTED_TAG_MESSAGE_TYPE,
+					       tag_payload, payload_len,
+					       priv->ints.timestamp_ns);
+	}
+	st25r391x_tag_event(priv,
+			    select_tag ? st25r391x_tag_selected :
+					 st25r391x_tag_detected,
+			    tag_payload->tag_type, uid, uid_len, tag_payload,
+			    payload_len, priv->ints.timestamp_ns);
+	if (priv->mode == mode_discover) {
+		st25r391x_tag_found(priv, tag_payload->tag_type, cid, uid,
+				    uid_len);
+	}
 
 	if (select_tag) {
 		priv->mode = mode_selected;
-		priv->mode_params.selected.tag_id.tag_type =
+		priv->mode_params->selected.tag_id.tag_type =
 			tag_payload->tag_type;
-		priv->mode_params.selected.tag_id.cid = cid;
-		priv->mode_params.selected.tag_id.uid_len = uid_len;
-		memcpy((void *)priv->mode_params.selected.tag_id.uid, uid,
+		priv->mode_params->selected.tag_id.cid = cid;
+		priv->mode_params->selected.tag_id.fwt_usec = fwt_usec;
+		priv->mode_params->selected.tag_id.uid_len = uid_len;
+		memcpy((void *)priv->mode_params->selected.tag_id.uid, uid,
 		       uid_len);
-		memset(priv->mode_params.selected.tag_id.uid + uid_len, 0,
-		       sizeof(priv->mode_params.selected.tag_id.uid) - uid_len);
+		memset(priv->mode_params->selected.tag_id.uid + uid_len, 0,
+		       sizeof(priv->mode_params->selected.tag_id.uid) -
+			       uid_len);
 		stop_polling_timer(priv);
 	} else {
-		if (priv->mode_params.discover.device_count > 0) {
-			priv->mode_params.discover.device_count--;
-			if (priv->mode_params.discover.device_count == 0) {
+		if (priv->mode_params->discover.device_count > 0) {
+			priv->mode_params->discover.device_count--;
+			if (priv->mode_params->discover.device_count == 0) {
 				st25r391x_transition_to_idle(priv);
 			}
 		}
@@ -194,12 +537,35 @@ void st25r391x_process_selected_tag(
  */
 static void st25r391x_do_discover(struct st25r391x_i2c_data *priv)
 {
-	if (st25r391x_turn_field_on(priv) < 0)
+	bool prescreen;
+
+	// Do not poll for tags nobody would read about.
+	if (priv->mode_params->discover.flags & NFC_DISCOVER_FLAGS_THROTTLE &&
+	    st25r391x_is_consumer_lagging(priv))
+		return;
+
+	// In wake-up mode, only poll when the chip sensed something. On error,
+	// poll anyway.
+	if (priv->wakeup.enabled && st25r391x_wakeup_check(priv) == 0)
+		return;
+
+	if (st25r391x_external_field_backoff(priv))
+		return;
+
+	if (st25r391x_field_on(priv) < 0)
+		return;
+	priv->present_tags_found = 0;
+
+	// Tags still present are polled to report their departure.
+	prescreen = priv->mode_params->discover.flags &
+			    NFC_DISCOVER_FLAGS_PRESCREEN &&
+		    priv->present_tags_count == 0;
+	if (prescreen && !st25r391x_prescreen(priv))
 		return;
 
 	// Technology depends on the current mode.
 	if (priv->mode == mode_discover &&
-	    priv->mode_params.discover.protocols &
+	    priv->mode_params->discover.protocols &
 		    (NFC_TAG_PROTOCOL_ISO14443A |
 		     NFC_TAG_PROTOCOL_ISO14443A_T2T |
 		     NFC_TAG_PROTOCOL_MIFARE_CLASSIC |
@@ -212,24 +578,52 @@ static void st25r391x_do_discover(struct st25r391x_i2c_data *priv)
 
 	// retest mode as discover may transition to idle/selected
 	if (priv->mode == mode_discover &&
-	    priv->mode_params.discover.protocols &
+	    priv->mode_params->discover.protocols &
 		    (NFC_TAG_PROTOCOL_ISO14443B)) {
 		// Passive poll NFC-B
 		st25r391x_nfcb_discover(priv);
 	}
 
 	if (priv->mode == mode_discover &&
-	    priv->mode_params.discover.protocols & (NFC_TAG_PROTOCOL_ST25TB)) {
+	    priv->mode_params->discover.protocols & (NFC_TAG_PROTOCOL_ST25TB)) {
 		// Passive poll ST25TB
 		st25r391x_st25tb_discover(priv);
 	}
 
 	if (priv->mode == mode_discover &&
-	    priv->mode_params.discover.protocols &
+	    priv->mode_params->discover.protocols &
 		    (NFC_TAG_PROTOCOL_NFCF | NFC_TAG_PROTOCOL_NFCF_NFCDEP)) {
 		// Passive poll ST25TB
 		st25r391x_nfcf_discover(priv);
 	}
+
+	if (prescreen) {
+		st25r391x_prescreen_result(priv, priv->present_tags_found != 0);
+	}
+
+	if (priv->mode == mode_discover) {
+		st25r391x_report_departed_tags(priv);
+		if (priv->mode_params->discover.flags &
+			    NFC_DISCOVER_FLAGS_WAKE_UP &&
+		    priv->present_tags_count == 0) {
+			(void)st25r391x_wakeup_enter(
+				priv, READ_ONCE(wake_up_interval_ms));
+		}
+	}
+}
+
+/**
+ * Determine if field should be kept on for next select attempt.
+ * Tags are re-polled with WUPA, which only exists with ISO14443-A.
+ */
+static bool st25r391x_keep_select_field(struct st25r391x_i2c_data *priv)
+{
+	u16 tag_type = priv->mode_params->select.tag_id.tag_type;
+
+	return priv->mode == mode_select && priv->field_on &&
+	       tag_type >= NFC_TAG_TYPE_ISO14443A &&
+	       tag_type <= NFC_TAG_TYPE_ISO14443A_T4T_NFCDEP &&
+	       time_before(jiffies, priv->select_field_deadline);
 }
 
 /**
@@ -237,53 +631,46 @@ static void st25r391x_do_discover(struct st25r391x_i2c_data *priv)
  */
 static void st25r391x_do_select(struct st25r391x_i2c_data *priv)
 {
-	if (st25r391x_turn_field_on(priv) < 0)
-		return;
+	if (!priv->select_field_kept || !priv->field_on) {
+		if (st25r391x_external_field_backoff(priv))
+			return;
+		priv->select_field_deadline = jiffies;
+		if (st25r391x_field_on(priv) < 0)
+			return;
+		priv->select_field_deadline +=
+			msecs_to_jiffies(READ_ONCE(select_field_on_ms));
+	}
 
 	// Technology depends on the current mode.
-	if (priv->mode_params.select.tag_id.tag_type >=
+	if (priv->mode_params->select.tag_id.tag_type >=
 		    NFC_TAG_TYPE_ISO14443A &&
-	    priv->mode_params.select.tag_id.tag_type <=
+	    priv->mode_params->select.tag_id.tag_type <=
 		    NFC_TAG_TYPE_ISO14443A_T4T_NFCDEP) {
 		st25r391x_nfca_select(priv);
-	} else if (priv->mode_params.select.tag_id.tag_type ==
+	} else if (priv->mode_params->select.tag_id.tag_type ==
 		   NFC_TAG_TYPE_ISO14443B) {
 		st25r391x_nfcb_select(priv);
-	} else if (priv->mode_params.select.tag_id.tag_type ==
+	} else if (priv->mode_params->select.tag_id.tag_type ==
 		   NFC_TAG_TYPE_ST25TB) {
 		st25r391x_st25tb_select(priv);
 	}
 }
 
 /**
- * Perform transceive polling.
+ * Compute response flags and received data length from transceive result.
  */
-static void st25r391x_do_transceive_frame(struct st25r391x_i2c_data *priv)
+static u16 st25r391x_transceive_response(s32 result, u8 flags,
+					 u8 *response_flags)
 {
-	struct nfc_message_header response_message_header;
-	struct nfc_message_transceive_frame_response_payload payload;
-	struct i2c_client *i2c = priv->i2c;
-	struct st25r391x_interrupts *ints = &priv->ints;
-	u8 result_flags = priv->mode_params.transceive_frame.flags &
-			  (NFC_TRANSCEIVE_FLAGS_NOCRC_RX |
-			   NFC_TRANSCEIVE_RESPONSE_FLAGS_NOPAR_RX |
-			   NFC_TRANSCEIVE_FLAGS_BITS);
 	u16 rx_data_count = 0;
-	u16 payload_len;
-	s32 result;
 
-	memset(&payload, 0, sizeof(payload));
-	result = st25r391x_transceive_frame(
-		i2c, ints, priv->mode_params.transceive_frame.tx_data,
-		priv->mode_params.transceive_frame.tx_count, payload.rx_data,
-		sizeof(payload.rx_data),
-		priv->mode_params.transceive_frame.flags,
-		priv->mode_params.transceive_frame.rx_timeout);
-	if (result == 0 && priv->mode_params.transceive_frame.flags &
-				   NFC_TRANSCEIVE_FLAGS_TIMEOUT) {
-		result_flags |= NFC_TRANSCEIVE_RESPONSE_FLAGS_TIMEOUT;
+	*response_flags = flags & (NFC_TRANSCEIVE_FLAGS_NOCRC_RX |
+				   NFC_TRANSCEIVE_RESPONSE_FLAGS_NOPAR_RX |
+				   NFC_TRANSCEIVE_FLAGS_BITS);
+	if (result == 0 && flags & NFC_TRANSCEIVE_FLAGS_TIMEOUT) {
+		*response_flags |= NFC_TRANSCEIVE_RESPONSE_FLAGS_TIMEOUT;
 	} else if (result > 0) {
-		if (result_flags & NFC_TRANSCEIVE_RESPONSE_FLAGS_BITS) {
+		if (*response_flags & NFC_TRANSCEIVE_RESPONSE_FLAGS_BITS) {
 			rx_data_count = result >> 3;
 			if (result & 0x07) {
 				rx_data_count++;
@@ -291,33 +678,282 @@ static void st25r391x_do_transceive_frame(struct st25r391x_i2c_data *priv)
 		} else {
 			rx_data_count = result;
 		}
+	} else if (result < 0) {
+		*response_flags = NFC_TRANSCEIVE_RESPONSE_FLAGS_ERROR;
+	}
+
+	return rx_data_count;
+}
+
+/**
+ * Return the rx timeout of a transceive request in usec, 0 meaning the frame
+ * waiting time of the selected tag.
+ */
+static u32 st25r391x_request_rx_timeout(struct st25r391x_i2c_data *priv,
+					u8 flags, u16 rx_timeout)
+{
+	// tag_id is shared by selected and transceive params.
+	if (rx_timeout == 0 && !(flags & transceive_frame_tx_only)) {
+		return priv->mode_params->selected.tag_id.fwt_usec;
 	}
+	return rx_timeout;
+}
+
+/**
+ * Perform transceive polling.
+ */
+static void st25r391x_do_transceive_frame(struct st25r391x_i2c_data *priv)
+{
+	struct nfc_message_transceive_frame_response_payload payload;
+	struct i2c_client *i2c = priv->i2c;
+	struct st25r391x_interrupts *ints = &priv->ints;
+	u8 flags = priv->mode_params->transceive_frame.flags;
+	u16 payload_len;
+	s32 result;
+
+	memset(&payload, 0, sizeof(payload));
+	result = st25r391x_transceive_frame(
+		i2c, ints, priv->mode_params->transceive_frame.tx_data,
+		priv->mode_params->transceive_frame.tx_count, payload.rx_data,
+		sizeof(payload.rx_data), flags,
+		st25r391x_request_rx_timeout(
+			priv, flags,
+			priv->mode_params->transceive_frame.rx_timeout));
 
 	payload_len =
-		rx_data_count +
+		st25r391x_transceive_response(result, flags, &payload.flags) +
 		offsetof(struct nfc_message_transceive_frame_response_payload,
 			 rx_data);
-	response_message_header.message_type =
-		NFC_TRANSCEIVE_FRAME_RESPONSE_MESSAGE_TYPE;
-	response_message_header.payload_length = payload_len;
-	st25r391x_write_to_device(priv, (const u8 *)&response_message_header,
-				  sizeof(response_message_header));
-
 	if (result >= 0) {
-		payload.flags = result_flags;
 		payload.rx_count = result;
-		st25r391x_write_to_device(priv, (const u8 *)&payload,
-					  payload_len);
+	}
+	st25r391x_write_client_message_at(
+		priv, priv->lease, NFC_TRANSCEIVE_FRAME_RESPONSE_MESSAGE_TYPE,
+		&payload, payload_len, priv->ints.timestamp_ns);
 
+	if (result >= 0) {
 		// tag_id is common between selected and transceive_frame params.
 		priv->mode = mode_selected;
 	} else {
-		payload.flags = NFC_TRANSCEIVE_RESPONSE_FLAGS_ERROR;
-		st25r391x_write_to_device(priv, (const u8 *)&payload,
-					  payload_len);
+		st25r391x_transition_to_idle(priv);
+	}
+}
+
+/**
+ * Transceive a frame of a transceive frames or script request, storing the
+ * response in frame_response which has room for rx_buf_len bytes of data.
+ * Set response_len to the length of the response.
+ */
+static s32 st25r391x_transceive_request_frame(
+	struct st25r391x_i2c_data *priv,
+	const struct nfc_transceive_frames_request_frame *frame,
+	struct nfc_transceive_frames_response_frame *frame_response,
+	u16 rx_buf_len, u16 *response_len)
+{
+	s32 result;
+
+	if (rx_buf_len > sizeof(frame_response->rx_data)) {
+		rx_buf_len = sizeof(frame_response->rx_data);
+	}
+	result = st25r391x_transceive_frame(priv->i2c, &priv->ints,
+					    frame->tx_data, frame->tx_count,
+					    frame_response->rx_data, rx_buf_len,
+					    frame->flags,
+					    st25r391x_request_rx_timeout(
+						    priv, frame->flags,
+						    frame->rx_timeout));
+	*response_len =
+		offsetof(struct nfc_transceive_frames_response_frame, rx_data) +
+		st25r391x_transceive_response(result, frame->flags,
+					      &frame_response->flags);
+	frame_response->rx_count = result >= 0 ? result : 0;
+
+	return result;
+}
+
+/**
+ * Perform transceive frames polling: execute frames one after the other and
+ * send all responses in a single message.
+ */
+static void st25r391x_do_transceive_frames(struct st25r391x_i2c_data *priv)
+{
+	struct st25r391x_transceive_frames_params *params =
+		&priv->mode_params->transceive_frames;
+	struct nfc_transceive_frames_response_message_payload *response =
+		&params->response;
+	u16 request_offset = 0;
+	u16 response_offset = 0;
+	int failed = 0;
+
+	response->flags = 0;
+	response->frame_count = 0;
+	while (response->frame_count < params->frame_count) {
+		const struct nfc_transceive_frames_request_frame *frame =
+			(const struct nfc_transceive_frames_request_frame
+				 *)(params->frames + request_offset);
+		struct nfc_transceive_frames_response_frame *frame_response =
+			(struct nfc_transceive_frames_response_frame
+				 *)(response->frames + response_offset);
+		const u16 rx_data_offset = offsetof(
+			struct nfc_transceive_frames_response_frame, rx_data);
+		u16 rx_buf_len = sizeof(response->frames) - response_offset;
+		u16 frame_response_len;
+		s32 result;
+
+		if (rx_buf_len <= rx_data_offset) {
+			// No room left for any response.
+			response->flags |=
+				NFC_TRANSCEIVE_FRAMES_RESPONSE_FLAGS_ERROR;
+			break;
+		}
+		result = st25r391x_transceive_request_frame(
+			priv, frame, frame_response,
+			rx_buf_len - rx_data_offset, &frame_response_len);
+
+		response_offset += frame_response_len;
+		request_offset +=
+			offsetof(struct nfc_transceive_frames_request_frame,
+				 tx_data) +
+			st25r391x_tx_bytes_count(frame->tx_count, frame->flags);
+		response->frame_count++;
+
+		if (result < 0) {
+			response->flags |=
+				NFC_TRANSCEIVE_FRAMES_RESPONSE_FLAGS_ERROR;
+			failed = 1;
+			if (params->flags &
+			    NFC_TRANSCEIVE_FRAMES_FLAGS_STOP_ON_ERROR) {
+				break;
+			}
+		}
+	}
 
+	st25r391x_write_client_message_at(
+		priv, priv->lease, NFC_TRANSCEIVE_FRAMES_RESPONSE_MESSAGE_TYPE,
+		response,
+		offsetof(struct nfc_transceive_frames_response_message_payload,
+			 frames) +
+			response_offset,
+		priv->ints.timestamp_ns);
+
+	if (failed &&
+	    params->flags & NFC_TRANSCEIVE_FRAMES_FLAGS_STOP_ON_ERROR) {
 		st25r391x_transition_to_idle(priv);
+	} else {
+		// tag_id is shared with selected params.
+		priv->mode = mode_selected;
+	}
+}
+
+/**
+ * Determine if response to a script step matches the step's pattern.
+ */
+static int st25r391x_transceive_script_step_matches(
+	const struct nfc_transceive_script_step *step,
+	const struct nfc_transceive_frames_response_frame *frame_response,
+	s32 result, u16 rx_data_count)
+{
+	const u8 *value;
+	const u8 *mask;
+	const u8 *data;
+	u8 ix;
+
+	if (result < 0 || rx_data_count < step->match_len) {
+		return 0;
+	}
+	value = step->frame.tx_data +
+		st25r391x_tx_bytes_count(step->frame.tx_count,
+					 step->frame.flags);
+	mask = value + step->match_len;
+	data = frame_response->rx_data;
+	if (step->match_flags & NFC_TRANSCEIVE_SCRIPT_MATCH_TAIL) {
+		data += rx_data_count - step->match_len;
 	}
+	for (ix = 0; ix < step->match_len; ix++) {
+		if ((data[ix] ^ value[ix]) & mask[ix]) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Perform transceive script polling: execute steps until the end of the script
+ * or a limit is reached, and send all responses in a single message.
+ */
+static void st25r391x_do_transceive_script(struct st25r391x_i2c_data *priv)
+{
+	struct st25r391x_transceive_script_params *params =
+		&priv->mode_params->transceive_script;
+	struct nfc_transceive_script_response_message_payload *response =
+		&params->response;
+	u64 timeout_ktime_ns = ktime_get_ns() + params->timeout * 1000000ULL;
+	u16 response_offset = 0;
+	u8 step_index = 0;
+
+	response->flags = 0;
+	response->final_step = 0;
+	response->step_count = 0;
+	while (step_index != NFC_TRANSCEIVE_SCRIPT_END) {
+		const struct nfc_transceive_script_step *step =
+			(const struct nfc_transceive_script_step
+				 *)(params->steps +
+				    params->step_offsets[step_index]);
+		struct nfc_transceive_script_response_step *step_response =
+			(struct nfc_transceive_script_response_step
+				 *)(response->steps + response_offset);
+		const u16 rx_data_offset = offsetof(
+			struct nfc_transceive_script_response_step,
+			frame.rx_data);
+		const u16 frame_rx_data_offset = offsetof(
+			struct nfc_transceive_frames_response_frame, rx_data);
+		u16 rx_buf_len = sizeof(response->steps) - response_offset;
+		u16 frame_response_len;
+		s32 result;
+
+		if (response->step_count ==
+			    NFC_TRANSCEIVE_SCRIPT_MAX_EXECUTED_STEPS ||
+		    ktime_get_ns() > timeout_ktime_ns) {
+			response->flags |=
+				NFC_TRANSCEIVE_SCRIPT_RESPONSE_FLAGS_LIMIT;
+			break;
+		}
+		if (rx_buf_len <= rx_data_offset) {
+			response->flags |=
+				NFC_TRANSCEIVE_SCRIPT_RESPONSE_FLAGS_FULL;
+			break;
+		}
+
+		result = st25r391x_transceive_request_frame(
+			priv, &step->frame, &step_response->frame,
+			rx_buf_len - rx_data_offset, &frame_response_len);
+		step_response->step = step_index;
+		step_response->matched =
+			st25r391x_transceive_script_step_matches(
+				step, &step_response->frame, result,
+				frame_response_len - frame_rx_data_offset);
+
+		response_offset +=
+			offsetof(struct nfc_transceive_script_response_step,
+				 frame) +
+			frame_response_len;
+		response->final_step = step_index;
+		response->step_count++;
+		step_index = step_response->matched ? step->on_match :
+							    step->on_mismatch;
+	}
+
+	st25r391x_write_client_message_at(
+		priv, priv->lease, NFC_TRANSCEIVE_SCRIPT_RESPONSE_MESSAGE_TYPE,
+		response,
+		offsetof(struct nfc_transceive_script_response_message_payload,
+			 steps) +
+			response_offset,
+		priv->ints.timestamp_ns);
+
+	// tag_id is shared with selected params.
+	priv->mode = mode_selected;
 }
 
 /**
@@ -327,6 +963,8 @@ static void st25r391x_do_poll(struct work_struct *work)
 {
 	struct st25r391x_i2c_data *priv =
 		container_of(work, struct st25r391x_i2c_data, polling_work);
+	bool keep_field = false;
+	bool restart_timer;
 
 	mutex_lock(&priv->command_lock);
 	if (priv->mode == mode_idle) {
@@ -338,49 +976,59 @@ static void st25r391x_do_poll(struct work_struct *work)
 		st25r391x_do_discover(priv);
 	} else if (priv->mode == mode_select) {
 		st25r391x_do_select(priv);
+		keep_field = st25r391x_keep_select_field(priv);
 	} else if (priv->mode == mode_transceive_frame) {
 		st25r391x_do_transceive_frame(priv);
+	} else if (priv->mode == mode_transceive_frames) {
+		st25r391x_do_transceive_frames(priv);
+	} else if (priv->mode == mode_transceive_script) {
+		st25r391x_do_transceive_script(priv);
 	}
 
-	priv->running_command = 0; // unlock mode & params
-	wake_up_interruptible(&priv->write_wq);
-	mutex_unlock(&priv->command_lock);
-
-	if (priv->field_on &&
+	priv->select_field_kept = keep_field;
+	// Turn field off before a new command may start using the chip.
+	if (priv->field_on && !keep_field &&
 	    (priv->mode == mode_idle || priv->mode == mode_select ||
 	     priv->mode == mode_discover)) {
-		(void)st25r391x_turn_field_off(priv);
+		st25r391x_field_off(priv);
 	}
+	restart_timer = priv->mode == mode_discover ||
+			priv->mode == mode_select;
 
-	if (priv->mode == mode_discover || priv->mode == mode_select) {
+	priv->running_command = 0; // unlock mode & params
+	wake_up_interruptible(&priv->write_wq);
+	mutex_unlock(&priv->command_lock);
+
+	if (restart_timer) {
 		restart_polling_timer(priv);
 	}
 }
 
 static void st25r391x_polling_timer_cb(struct timer_list *t)
 {
-	struct st25r391x_i2c_data *priv = from_timer(priv, t, polling_timer);
-	if (priv->opened) {
+	struct st25r391x_i2c_data *priv =
+		timer_container_of(priv, t, polling_timer);
+	if (READ_ONCE(priv->client_count)) {
 		schedule_work(&priv->polling_work);
 	}
 }
 
 static void restart_polling_timer(struct st25r391x_i2c_data *priv)
 {
-	del_timer_sync(&priv->polling_timer);
+	timer_delete_sync(&priv->polling_timer);
 	mod_timer(&priv->polling_timer,
 		  jiffies + HZ / POLLING_TIMEOUT_SECS_DIV);
 }
 
 static void stop_polling_timer(struct st25r391x_i2c_data *priv)
 {
-	del_timer_sync(&priv->polling_timer);
+	timer_delete_sync(&priv->polling_timer);
 }
 
 static void trigger_polling_work(struct st25r391x_i2c_data *priv)
 {
-	del_timer_sync(&priv->polling_timer);
-	if (priv->opened) {
+	timer_delete_sync(&priv->polling_timer);
+	if (READ_ONCE(priv->client_count)) {
 		schedule_work(&priv->polling_work);
 	}
 }
@@ -389,95 +1037,326 @@ static void trigger_polling_work(struct st25r391x_i2c_data *priv)
 // File operations & commands
 // ========================================================================== //
 
-static int st25r391x_open(struct inode *inode, struct file *file)
+static u32 st25r391x_read_buffer_size(u32 size)
 {
-	struct st25r391x_i2c_data *priv;
-	priv = container_of(inode->i_cdev, struct st25r391x_i2c_data, cdev);
-	file->private_data = priv;
+	return roundup_pow_of_two(clamp(size, (u32)CIRCULAR_BUFFER_MIN_SIZE,
+					(u32)CIRCULAR_BUFFER_MAX_SIZE));
+}
 
-	if (priv->opened) {
-		return -EBUSY;
-	}
-	priv->opened = 1;
-	priv->running_command = 0;
-	priv->write_offset = 0;
-	priv->read_buffer_head = 0;
-	priv->read_buffer_tail = 0;
-	priv->mode = mode_idle;
+static void st25r391x_free_client(struct st25r391x_client *client)
+{
+	vfree(client->event_ring);
+	kvfree(client->read_buffer);
+	kfree(client);
+}
 
-	return 0;
+/**
+ * Allocate data of a new file.
+ */
+static struct st25r391x_client *
+st25r391x_alloc_client(struct st25r391x_i2c_data *priv)
+{
+	struct st25r391x_client *client;
+
+	client = kzalloc(sizeof(*client), GFP_KERNEL);
+	if (client == NULL) {
+		return NULL;
+	}
+	client->read_buffer_size = st25r391x_read_buffer_size(read_buffer_size);
+	client->read_buffer = kvmalloc(client->read_buffer_size, GFP_KERNEL);
+	if (client->read_buffer == NULL) {
+		kfree(client);
+		return NULL;
+	}
+	client->priv = priv;
+	mutex_init(&client->consumer_lock);
+	init_waitqueue_head(&client->read_wq);
+	client->protocol_version = NFC_PROTOCOL_VERSION_1;
+	client->overflow_policy = NFC_OVERFLOW_POLICY_DROP_NEWEST;
+	return client;
 }
 
-static int st25r391x_release(struct inode *inode, struct file *file)
+static int st25r391x_open(struct inode *inode, struct file *file)
 {
 	struct st25r391x_i2c_data *priv;
+	struct st25r391x_client *client;
+	union st25r391x_mode_params *mode_params = NULL;
 	priv = container_of(inode->i_cdev, struct st25r391x_i2c_data, cdev);
-	priv->opened = 0;
 
-	cancel_work_sync(&priv->polling_work);
-	stop_polling_timer(priv);
+	client = st25r391x_alloc_client(priv);
+	if (client == NULL) {
+		return -ENOMEM;
+	}
+	file->private_data = client;
+
+	mutex_lock(&priv->command_lock);
+	if (priv->mode_params == NULL) {
+		// First client, mode params are shared by all clients.
+		mode_params = kzalloc(sizeof(*mode_params), GFP_KERNEL);
+		if (mode_params == NULL) {
+			mutex_unlock(&priv->command_lock);
+			st25r391x_free_client(client);
+			return -ENOMEM;
+		}
+		priv->mode_params = mode_params;
+		priv->running_command = 0;
+		priv->lease = NULL;
+		priv->mode = mode_idle;
+	}
+	spin_lock(&priv->producer_lock);
+	list_add_tail(&client->list, &priv->clients);
+	WRITE_ONCE(priv->client_count, priv->client_count + 1);
+	spin_unlock(&priv->producer_lock);
+	mutex_unlock(&priv->command_lock);
 
 	return 0;
 }
 
-static ssize_t st25r391x_read(struct file *file, char __user *buffer,
-			      size_t len, loff_t *ppos)
+static int st25r391x_release(struct inode *inode, struct file *file)
 {
-	struct st25r391x_i2c_data *priv =
-		(struct st25r391x_i2c_data *)file->private_data;
-	int read_count = 0;
-	spin_lock(&priv->consumer_lock);
-	if (wait_event_interruptible(priv->read_wq,
-				     priv->read_buffer_head !=
-					     priv->read_buffer_tail)) {
-		spin_unlock(&priv->consumer_lock);
-		return -ERESTARTSYS;
+	struct st25r391x_client *client =
+		(struct st25r391x_client *)file->private_data;
+	struct st25r391x_i2c_data *priv = client->priv;
+	int last_client;
+
+	mutex_lock(&priv->command_lock);
+	if (priv->lease == client) {
+		// Nobody would read the result of pending command.
+		priv->lease = NULL;
+		if (priv->mode != mode_idle) {
+			st25r391x_transition_to_idle(priv);
+		}
+		priv->running_command = 0;
+		wake_up_interruptible(&priv->write_wq);
 	}
-	/* Read index before reading contents at that index. */
-	while (len > 0) {
-		unsigned long head = smp_load_acquire(&priv->read_buffer_head);
-		unsigned long tail = priv->read_buffer_tail;
-		if (CIRC_CNT(head, tail, CIRCULAR_BUFFER_SIZE) >= 1) {
-			if (copy_to_user(buffer, &priv->read_buffer[tail], 1)) {
-				read_count = -EFAULT;
-				break;
-			}
-			buffer++;
-			read_count++;
-			len--;
-			/* Finish reading descriptor before incrementing tail. */
-			smp_store_release(&priv->read_buffer_tail,
-					  (tail + 1) &
-						  (CIRCULAR_BUFFER_SIZE - 1));
-		} else {
-			// Len was exhausted, exit
-			break;
+	spin_lock(&priv->producer_lock);
+	list_del(&client->list);
+	WRITE_ONCE(priv->client_count, priv->client_count - 1);
+	last_client = priv->client_count == 0;
+	spin_unlock(&priv->producer_lock);
+	mutex_unlock(&priv->command_lock);
+
+	if (last_client) {
+		cancel_work_sync(&priv->polling_work);
+		stop_polling_timer(priv);
+		mutex_lock(&priv->command_lock);
+		// Another client may have opened the device in the meantime.
+		if (priv->client_count == 0) {
+			kfree(priv->mode_params);
+			priv->mode_params = NULL;
+		}
+		mutex_unlock(&priv->command_lock);
+	}
+
+	if (client->eventfd) {
+		eventfd_ctx_put(client->eventfd);
+	}
+	// Mapping holds a reference to the file, so ring is no longer mapped.
+	st25r391x_free_client(client);
+
+	return 0;
+}
+
+static ssize_t st25r391x_read(struct file *file, char __user *buffer,
+			      size_t len, loff_t *ppos)
+{
+	struct st25r391x_client *client =
+		(struct st25r391x_client *)file->private_data;
+	ssize_t read_count;
+	if (mutex_lock_interruptible(&client->consumer_lock)) {
+		return -ERESTARTSYS;
+	}
+	while (!st25r391x_has_message(client)) {
+		// Do not sleep while holding the lock.
+		mutex_unlock(&client->consumer_lock);
+		if (file->f_flags & O_NONBLOCK) {
+			return -EAGAIN;
+		}
+		if (wait_event_interruptible(client->read_wq,
+					     st25r391x_has_message(client))) {
+			return -ERESTARTSYS;
+		}
+		if (mutex_lock_interruptible(&client->consumer_lock)) {
+			return -ERESTARTSYS;
 		}
 	}
-	spin_unlock(&priv->consumer_lock);
+	read_count = st25r391x_read_messages(client, buffer, len);
+	mutex_unlock(&client->consumer_lock);
 	if (read_count > 0) {
 		*ppos += read_count;
 	}
 	return read_count;
 }
 
-static void st25r391x_write_process_packet(struct st25r391x_i2c_data *priv,
+static void
+st25r391x_write_transceive_frames_error(struct st25r391x_client *client)
+{
+	u8 buffer[offsetof(
+		struct nfc_transceive_frames_response_message_payload, frames)];
+	struct nfc_transceive_frames_response_message_payload *payload =
+		(struct nfc_transceive_frames_response_message_payload *)buffer;
+
+	payload->flags = NFC_TRANSCEIVE_FRAMES_RESPONSE_FLAGS_ERROR;
+	payload->frame_count = 0;
+	st25r391x_write_client_message(
+		client->priv, client,
+		NFC_TRANSCEIVE_FRAMES_RESPONSE_MESSAGE_TYPE, buffer,
+		sizeof(buffer));
+}
+
+/**
+ * Return the length of a frame of a transceive frames or script request, or 0
+ * if the frame does not fit in len bytes.
+ */
+static u16 st25r391x_request_frame_len(const u8 *buffer, u16 len)
+{
+	const struct nfc_transceive_frames_request_frame *frame =
+		(const struct nfc_transceive_frames_request_frame *)buffer;
+	const u16 tx_data_offset =
+		offsetof(struct nfc_transceive_frames_request_frame, tx_data);
+	u16 tx_bytes_count;
+
+	if (len < tx_data_offset) {
+		return 0;
+	}
+	tx_bytes_count =
+		st25r391x_tx_bytes_count(frame->tx_count, frame->flags);
+	if (tx_bytes_count > sizeof(frame->tx_data) ||
+	    len - tx_data_offset < tx_bytes_count) {
+		return 0;
+	}
+
+	return tx_data_offset + tx_bytes_count;
+}
+
+/**
+ * Check that frames of a transceive frames request are consistent with
+ * payload length.
+ */
+static int st25r391x_transceive_frames_valid(const u8 *frames, u16 frames_len,
+					     u8 frame_count)
+{
+	u16 offset = 0;
+	u8 ix;
+
+	if (frame_count > NFC_TRANSCEIVE_FRAMES_MAX_COUNT) {
+		return 0;
+	}
+	for (ix = 0; ix < frame_count; ix++) {
+		u16 frame_len = st25r391x_request_frame_len(
+			frames + offset, frames_len - offset);
+		if (frame_len == 0) {
+			return 0;
+		}
+		offset += frame_len;
+	}
+
+	return offset == frames_len;
+}
+
+/**
+ * Check that steps of a transceive script are consistent with their length
+ * and compute their offsets.
+ */
+static int st25r391x_transceive_script_valid(
+	struct st25r391x_transceive_script_params *params, u16 steps_len)
+{
+	const u16 frame_offset =
+		offsetof(struct nfc_transceive_script_step, frame);
+	u16 offset = 0;
+	u8 ix;
+
+	if (params->step_count == 0 ||
+	    params->step_count > NFC_TRANSCEIVE_SCRIPT_MAX_STEPS) {
+		return 0;
+	}
+	for (ix = 0; ix < params->step_count; ix++) {
+		const struct nfc_transceive_script_step *step;
+		u16 frame_len;
+
+		if (steps_len - offset < frame_offset) {
+			return 0;
+		}
+		step = (const struct nfc_transceive_script_step
+				*)(params->steps + offset);
+		if (step->match_len > NFC_TRANSCEIVE_SCRIPT_MAX_MATCH_LEN ||
+		    (step->on_match >= params->step_count &&
+		     step->on_match != NFC_TRANSCEIVE_SCRIPT_END) ||
+		    (step->on_mismatch >= params->step_count &&
+		     step->on_mismatch != NFC_TRANSCEIVE_SCRIPT_END)) {
+			return 0;
+		}
+		frame_len = st25r391x_request_frame_len(
+			params->steps + offset + frame_offset,
+			steps_len - offset - frame_offset);
+		if (frame_len == 0 ||
+		    steps_len - offset - frame_offset - frame_len <
+			    2 * step->match_len) {
+			return 0;
+		}
+		params->step_offsets[ix] = offset;
+		offset += frame_offset + frame_len + 2 * step->match_len;
+	}
+
+	return offset == steps_len;
+}
+
+static void
+st25r391x_write_transceive_script_error(struct st25r391x_client *client)
+{
+	u8 buffer[offsetof(
+		struct nfc_transceive_script_response_message_payload, steps)];
+	struct nfc_transceive_script_response_message_payload *payload =
+		(struct nfc_transceive_script_response_message_payload *)buffer;
+
+	payload->flags = NFC_TRANSCEIVE_SCRIPT_RESPONSE_FLAGS_ERROR;
+	payload->final_step = 0;
+	payload->step_count = 0;
+	st25r391x_write_client_message(
+		client->priv, client,
+		NFC_TRANSCEIVE_SCRIPT_RESPONSE_MESSAGE_TYPE, buffer,
+		sizeof(buffer));
+}
+
+/**
+ * Grant the reader to client unless another client owns it, in which case
+ * the request is denied.
+ * Return whether the request can be processed.
+ */
+static int st25r391x_acquire_lease(struct st25r391x_client *client,
+				   u8 message_type)
+{
+	struct st25r391x_i2c_data *priv = client->priv;
+	struct nfc_request_denied_message_payload payload;
+
+	if (priv->lease != NULL && priv->lease != client) {
+		payload.message_type = message_type;
+		st25r391x_write_client_message(
+			priv, client, NFC_REQUEST_DENIED_MESSAGE_TYPE, &payload,
+			sizeof(payload));
+		return 0;
+	}
+	priv->lease = client;
+	return 1;
+}
+
+static void st25r391x_write_process_packet(struct st25r391x_client *client,
 					   u16 payload_len)
 {
+	struct st25r391x_i2c_data *priv = client->priv;
 	uint8_t message_type =
-		((struct nfc_message_header *)priv->write_buffer)->message_type;
+		((struct nfc_message_header *)client->write_buffer)
+			->message_type;
+	if (message_type != NFC_IDENTIFY_REQUEST_MESSAGE_TYPE &&
+	    !st25r391x_acquire_lease(client, message_type)) {
+		return;
+	}
 	switch (message_type) {
 	case NFC_IDENTIFY_REQUEST_MESSAGE_TYPE: {
 		size_t identity_payload_len = sizeof(CHIP_MODEL_IDENTITY) - 1;
-		struct nfc_message_header identity_response_header;
-		identity_response_header.message_type =
-			NFC_IDENTIFY_RESPONSE_MESSAGE_TYPE;
-		identity_response_header.payload_length = identity_payload_len;
-		st25r391x_write_to_device(priv,
-					  (const u8 *)&identity_response_header,
-					  sizeof(identity_response_header));
-		st25r391x_write_to_device(priv, CHIP_MODEL_IDENTITY,
-					  identity_payload_len);
+		st25r391x_write_client_message(
+			priv, client, NFC_IDENTIFY_RESPONSE_MESSAGE_TYPE,
+			CHIP_MODEL_IDENTITY, identity_payload_len);
 		break;
 	}
 
@@ -491,15 +1370,18 @@ static void st25r391x_write_process_packet(struct st25r391x_i2c_data *priv,
 	case NFC_DISCOVER_MODE_REQUEST_MESSAGE_TYPE: {
 		const struct nfc_discover_mode_request_message_payload *payload =
 			(const struct nfc_discover_mode_request_message_payload
-				 *)(priv->write_buffer +
+				 *)(client->write_buffer +
 				    sizeof(struct nfc_message_header));
-		priv->mode_params.discover.protocols = payload->protocols;
-		priv->mode_params.discover.polling_period =
+		priv->mode_params->discover.protocols = payload->protocols;
+		priv->mode_params->discover.polling_period =
 			payload->polling_period;
-		priv->mode_params.discover.device_count = payload->device_count;
-		priv->mode_params.discover.max_bitrate = payload->max_bitrate;
-		priv->mode_params.discover.flags = payload->flags;
+		priv->mode_params->discover.device_count =
+			payload->device_count;
+		priv->mode_params->discover.max_bitrate = payload->max_bitrate;
+		priv->mode_params->discover.flags = payload->flags;
 		if (priv->mode != mode_discover) {
+			priv->present_tags_count = 0;
+			st25r391x_leave_idle(priv);
 			priv->mode = mode_discover;
 			trigger_polling_work(priv);
 		}
@@ -509,28 +1391,28 @@ static void st25r391x_write_process_packet(struct st25r391x_i2c_data *priv,
 	case NFC_SELECT_TAG_MESSAGE_TYPE: {
 		const struct nfc_select_tag_message_payload *payload =
 			(const struct nfc_select_tag_message_payload
-				 *)(priv->write_buffer +
+				 *)(client->write_buffer +
 				    sizeof(struct nfc_message_header));
-		memset(&priv->mode_params.select, 0,
-		       sizeof(priv->mode_params.select));
-		priv->mode_params.select.tag_id.tag_type = payload->tag_type;
+		memset(&priv->mode_params->select, 0,
+		       sizeof(priv->mode_params->select));
+		priv->mode_params->select.tag_id.tag_type = payload->tag_type;
 		if (payload->tag_type >= NFC_TAG_TYPE_ISO14443A &&
 		    payload->tag_type <= NFC_TAG_TYPE_ISO14443A_T4T_NFCDEP) {
-			priv->mode_params.select.tag_id.uid_len =
+			priv->mode_params->select.tag_id.uid_len =
 				payload->tag_id.iso14443a.uid_len;
-			memcpy(priv->mode_params.select.tag_id.uid,
+			memcpy(priv->mode_params->select.tag_id.uid,
 			       (const void *)payload->tag_id.iso14443a.uid,
 			       payload->tag_id.iso14443a.uid_len);
 		} else if (payload->tag_type == NFC_TAG_TYPE_ISO14443B) {
-			priv->mode_params.select.tag_id.uid_len =
+			priv->mode_params->select.tag_id.uid_len =
 				sizeof(payload->tag_id.iso14443b.pupi);
-			memcpy(priv->mode_params.select.tag_id.uid,
+			memcpy(priv->mode_params->select.tag_id.uid,
 			       (const void *)payload->tag_id.iso14443b.pupi,
 			       sizeof(payload->tag_id.iso14443b.pupi));
 		} else if (payload->tag_type == NFC_TAG_TYPE_ST25TB) {
-			priv->mode_params.select.tag_id.uid_len =
+			priv->mode_params->select.tag_id.uid_len =
 				sizeof(payload->tag_id.st25tb.uid);
-			memcpy(priv->mode_params.select.tag_id.uid,
+			memcpy(priv->mode_params->select.tag_id.uid,
 			       (const void *)payload->tag_id.st25tb.uid,
 			       sizeof(payload->tag_id.st25tb.uid));
 		} else {
@@ -539,6 +1421,7 @@ static void st25r391x_write_process_packet(struct st25r391x_i2c_data *priv,
 				payload->tag_type);
 		}
 		if (priv->mode != mode_select) {
+			st25r391x_leave_idle(priv);
 			priv->mode = mode_select;
 			trigger_polling_work(priv);
 		}
@@ -549,7 +1432,6 @@ static void st25r391x_write_process_packet(struct st25r391x_i2c_data *priv,
 		const struct nfc_transceive_frame_request_message_payload
 			*payload;
 		if (priv->mode != mode_selected) {
-			struct nfc_message_header response_message_header;
 			struct nfc_message_transceive_frame_response_payload
 				payload;
 
@@ -559,15 +1441,11 @@ static void st25r391x_write_process_packet(struct st25r391x_i2c_data *priv,
 			payload_len = offsetof(
 				struct nfc_message_transceive_frame_response_payload,
 				rx_data);
-			response_message_header.message_type =
-				NFC_TRANSCEIVE_FRAME_RESPONSE_MESSAGE_TYPE;
-			response_message_header.payload_length = payload_len;
-			st25r391x_write_to_device(
-				priv, (const u8 *)&response_message_header,
-				sizeof(response_message_header));
 			payload.flags = NFC_TRANSCEIVE_RESPONSE_FLAGS_ERROR;
-			st25r391x_write_to_device(priv, (const u8 *)&payload,
-						  payload_len);
+			st25r391x_write_client_message(
+				priv, client,
+				NFC_TRANSCEIVE_FRAME_RESPONSE_MESSAGE_TYPE,
+				&payload, payload_len);
 
 			if (priv->mode != mode_idle) {
 				st25r391x_transition_to_idle(priv);
@@ -576,18 +1454,16 @@ static void st25r391x_write_process_packet(struct st25r391x_i2c_data *priv,
 		}
 		payload =
 			(const struct nfc_transceive_frame_request_message_payload
-				 *)(priv->write_buffer +
+				 *)(client->write_buffer +
 				    sizeof(struct nfc_message_header));
 		// tag_id is common between selected and transceive_frame params
-		priv->mode_params.transceive_frame.tx_count = payload->tx_count;
-		priv->mode_params.transceive_frame.flags = payload->flags;
-		priv->mode_params.transceive_frame.rx_timeout =
+		priv->mode_params->transceive_frame.tx_count =
+			payload->tx_count;
+		priv->mode_params->transceive_frame.flags = payload->flags;
+		priv->mode_params->transceive_frame.rx_timeout =
 			payload->rx_timeout;
-		memcpy((void *)priv->mode_params.transceive_frame.tx_data,
-		       priv->write_buffer + sizeof(struct nfc_message_header) +
-			       offsetof(
-				       struct nfc_transceive_frame_request_message_payload,
-				       tx_data),
+		memcpy((void *)priv->mode_params->transceive_frame.tx_data,
+		       payload->tx_data,
 		       payload_len -
 			       offsetof(
 				       struct nfc_transceive_frame_request_message_payload,
@@ -598,149 +1474,785 @@ static void st25r391x_write_process_packet(struct st25r391x_i2c_data *priv,
 			1; // Block further commands until this one is executed.
 		break;
 	}
+
+	case NFC_TRANSCEIVE_FRAMES_REQUEST_MESSAGE_TYPE: {
+		const struct nfc_transceive_frames_request_message_payload
+			*payload;
+		const u16 frames_offset = offsetof(
+			struct nfc_transceive_frames_request_message_payload,
+			frames);
+		if (priv->mode != mode_selected) {
+			dev_err(priv->device,
+				"NFC_TRANSCEIVE_FRAMES_REQUEST_MESSAGE_TYPE: unexpected message, tag must be selected first (mode=%d)",
+				priv->mode);
+			st25r391x_write_transceive_frames_error(client);
+			if (priv->mode != mode_idle) {
+				st25r391x_transition_to_idle(priv);
+			}
+			break;
+		}
+		payload = (const struct
+			   nfc_transceive_frames_request_message_payload
+				   *)(client->write_buffer +
+				      sizeof(struct nfc_message_header));
+		if (payload_len < frames_offset ||
+		    !st25r391x_transceive_frames_valid(
+			    payload->frames, payload_len - frames_offset,
+			    payload->frame_count)) {
+			dev_err(priv->device,
+				"NFC_TRANSCEIVE_FRAMES_REQUEST_MESSAGE_TYPE: malformed request (payload_len=%d)",
+				payload_len);
+			st25r391x_write_transceive_frames_error(client);
+			break;
+		}
+		// tag_id is shared with selected params
+		priv->mode_params->transceive_frames.flags = payload->flags;
+		priv->mode_params->transceive_frames.frame_count =
+			payload->frame_count;
+		priv->mode_params->transceive_frames.frames_len =
+			payload_len - frames_offset;
+		memcpy((void *)priv->mode_params->transceive_frames.frames,
+		       payload->frames, payload_len - frames_offset);
+		priv->mode = mode_transceive_frames;
+		trigger_polling_work(priv);
+		priv->running_command =
+			1; // Block further commands until this one is executed.
+		break;
+	}
+
+	case NFC_TRANSCEIVE_SCRIPT_REQUEST_MESSAGE_TYPE: {
+		const struct nfc_transceive_script_request_message_payload
+			*payload;
+		const u16 steps_offset = offsetof(
+			struct nfc_transceive_script_request_message_payload,
+			steps);
+		if (priv->mode != mode_selected) {
+			dev_err(priv->device,
+				"NFC_TRANSCEIVE_SCRIPT_REQUEST_MESSAGE_TYPE: unexpected message, tag must be selected first (mode=%d)",
+				priv->mode);
+			st25r391x_write_transceive_script_error(client);
+			if (priv->mode != mode_idle) {
+				st25r391x_transition_to_idle(priv);
+			}
+			break;
+		}
+		payload = (const struct
+			   nfc_transceive_script_request_message_payload
+				   *)(client->write_buffer +
+				      sizeof(struct nfc_message_header));
+		if (payload_len < steps_offset) {
+			dev_err(priv->device,
+				"NFC_TRANSCEIVE_SCRIPT_REQUEST_MESSAGE_TYPE: malformed request (payload_len=%d)",
+				payload_len);
+			st25r391x_write_transceive_script_error(client);
+			break;
+		}
+		// tag_id is shared with selected params
+		priv->mode_params->transceive_script.timeout =
+			payload->timeout > NFC_TRANSCEIVE_SCRIPT_MAX_TIMEOUT ?
+				      NFC_TRANSCEIVE_SCRIPT_MAX_TIMEOUT :
+				      payload->timeout;
+		priv->mode_params->transceive_script.step_count =
+			payload->step_count;
+		memcpy((void *)priv->mode_params->transceive_script.steps,
+		       payload->steps, payload_len - steps_offset);
+		if (!st25r391x_transceive_script_valid(
+			    &priv->mode_params->transceive_script,
+			    payload_len - steps_offset)) {
+			dev_err(priv->device,
+				"NFC_TRANSCEIVE_SCRIPT_REQUEST_MESSAGE_TYPE: malformed script (payload_len=%d)",
+				payload_len);
+			st25r391x_write_transceive_script_error(client);
+			break;
+		}
+		priv->mode = mode_transceive_script;
+		trigger_polling_work(priv);
+		priv->running_command =
+			1; // Block further commands until this one is executed.
+		break;
+	}
+	}
+	// Reader is released once back to idle.
+	if (priv->mode == mode_idle) {
+		priv->lease = NULL;
 	}
 }
 
-static int st25r391x_write_bytes(struct st25r391x_i2c_data *priv,
-				 const char __user *buffer, size_t buffer_len,
-				 size_t count)
+static int st25r391x_write_bytes(struct st25r391x_client *client,
+				 struct iov_iter *from, size_t count)
 {
-	size_t actual = count > buffer_len ? buffer_len : count;
-	if (copy_from_user(priv->write_buffer + priv->write_offset, buffer,
-			   actual))
+	size_t actual = count > iov_iter_count(from) ? iov_iter_count(from) :
+							 count;
+	if (copy_from_iter(client->write_buffer + client->write_offset, actual,
+			   from) != actual)
 		return -EFAULT;
-	priv->write_offset += actual;
+	client->write_offset += actual;
 	return actual;
 }
 
-static ssize_t st25r391x_write(struct file *file, const char __user *buffer,
-			       size_t len, loff_t *ppos)
+/**
+ * Process as many bytes as possible from a single message.
+ * Return the number of bytes processed or an error.
+ */
+static ssize_t st25r391x_write_message_bytes(struct st25r391x_client *client,
+					     struct iov_iter *from)
 {
-	struct st25r391x_i2c_data *priv =
-		(struct st25r391x_i2c_data *)file->private_data;
-	int written_count = 0;
-	if (len == 0) {
-		return 0;
+	struct st25r391x_i2c_data *priv = client->priv;
+	ssize_t written_count = 0;
+	int result;
+	u16 payload_len;
+
+	if (client->write_offset < sizeof(struct nfc_message_header)) {
+		result = st25r391x_write_bytes(
+			client, from,
+			sizeof(struct nfc_message_header) -
+				client->write_offset);
+		if (result < 0)
+			return result;
+		written_count = result;
+		if (client->write_offset < sizeof(struct nfc_message_header))
+			return written_count;
 	}
-	mutex_lock(&priv->command_lock);
-	if (wait_event_interruptible(priv->write_wq,
-				     priv->running_command == 0)) {
-		mutex_unlock(&priv->command_lock);
-		return -ERESTARTSYS;
+	payload_len = ((struct nfc_message_header *)client->write_buffer)
+			      ->payload_length;
+	if (payload_len > MAX_PACKET_SIZE - sizeof(struct nfc_message_header)) {
+		dev_err(priv->device,
+			"st25r391x_write_message_bytes: payload is too large (payload_len=%d)",
+			payload_len);
+		// Drop the header so client can start over.
+		client->write_offset = 0;
+		return -EMSGSIZE;
 	}
-	do {
-		u16 payload_len = 0;
-		if (priv->write_offset < sizeof(struct nfc_message_header)) {
-			written_count = st25r391x_write_bytes(
-				priv, buffer, len,
-				sizeof(struct nfc_message_header) -
-					priv->write_offset);
-			if (written_count < 0)
-				break;
-			len -= written_count;
-			buffer += written_count;
-		}
-		payload_len = ((struct nfc_message_header *)priv->write_buffer)
-				      ->payload_length;
-		if (priv->write_offset <
-		    payload_len + sizeof(struct nfc_message_header)) {
-			int payload_written_count = st25r391x_write_bytes(
-				priv, buffer, len,
-				sizeof(struct nfc_message_header) +
-					payload_len - priv->write_offset);
-			if (payload_written_count < 0)
-				break;
-			written_count += payload_written_count;
-			len -= payload_written_count;
-			buffer += payload_written_count;
+	if (client->write_offset <
+	    payload_len + sizeof(struct nfc_message_header)) {
+		result = st25r391x_write_bytes(
+			client, from,
+			sizeof(struct nfc_message_header) + payload_len -
+				client->write_offset);
+		if (result < 0)
+			return result;
+		written_count += result;
+	}
+	if (client->write_offset ==
+	    payload_len + sizeof(struct nfc_message_header)) {
+		st25r391x_write_process_packet(client, payload_len);
+		client->write_offset = 0;
+	}
+	return written_count;
+}
+
+/**
+ * Process every complete message of the buffer(s), keeping partial trailing
+ * data for the next call.
+ */
+static ssize_t st25r391x_write_messages(struct st25r391x_client *client,
+					struct iov_iter *from, int nonblock)
+{
+	struct st25r391x_i2c_data *priv = client->priv;
+	ssize_t written_count = 0;
+	ssize_t result = 0;
+
+	while (iov_iter_count(from) > 0) {
+		if (priv->running_command && nonblock) {
+			result = -EAGAIN;
+			break;
 		}
-		if (priv->write_offset ==
-		    payload_len + sizeof(struct nfc_message_header)) {
-			st25r391x_write_process_packet(priv, payload_len);
-			priv->write_offset = 0;
+		// Polling work needs command_lock to complete the running
+		// command, so wait without holding it.
+		if (wait_event_interruptible(priv->write_wq,
+					     priv->running_command == 0)) {
+			result = -ERESTARTSYS;
+			break;
 		}
-	} while (0);
-	mutex_unlock(&priv->command_lock);
+		mutex_lock(&priv->command_lock);
+		if (priv->running_command) {
+			mutex_unlock(&priv->command_lock);
+			continue;
+		}
+		result = st25r391x_write_message_bytes(client, from);
+		mutex_unlock(&priv->command_lock);
+		if (result < 0)
+			break;
+		written_count += result;
+	}
 	if (written_count > 0) {
-		*ppos += written_count;
+		return written_count;
 	}
-	return written_count;
+	return result;
+}
+
+static ssize_t st25r391x_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct st25r391x_client *client =
+		(struct st25r391x_client *)iocb->ki_filp->private_data;
+	ssize_t result;
+
+	result = st25r391x_write_messages(
+		client, from,
+		iocb->ki_filp->f_flags & O_NONBLOCK ||
+			iocb->ki_flags & IOCB_NOWAIT);
+	if (result > 0) {
+		iocb->ki_pos += result;
+	}
+	return result;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+// Task work callbacks no longer get issue flags.
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
+#define ST25R391X_URING_TASK_CB_ARG io_tw_token_t tw
+#define ST25R391X_URING_TASK_CB_ISSUE_FLAGS IO_URING_CMD_TASK_WORK_ISSUE_FLAGS
+#else
+#define ST25R391X_URING_TASK_CB_ARG unsigned int issue_flags
+#define ST25R391X_URING_TASK_CB_ISSUE_FLAGS issue_flags
+#endif
+
+/**
+ * Pending io_uring command, waiting on read_wq for a message or on write_wq
+ * for the running command to complete.
+ */
+struct st25r391x_uring_wait {
+	struct wait_queue_entry wait;
+	wait_queue_head_t *head;
+	struct io_uring_cmd *ioucmd;
+	struct st25r391x_client *client;
+	u32 cmd_op;
+	u32 len;
+	u64 addr;
+};
+
+static struct st25r391x_uring_wait **
+st25r391x_uring_pdu(struct io_uring_cmd *ioucmd)
+{
+	return (struct st25r391x_uring_wait **)ioucmd->pdu;
+}
+
+/**
+ * Process a command without blocking.
+ * Return -EAGAIN if it should be retried later.
+ */
+static ssize_t st25r391x_uring_try(struct st25r391x_uring_wait *uring_wait)
+{
+	struct st25r391x_client *client = uring_wait->client;
+	struct iov_iter iter;
+	ssize_t result;
+
+	if (uring_wait->cmd_op == NFC_URING_CMD_WRITE) {
+		result = import_ubuf(ITER_SOURCE,
+				     u64_to_user_ptr(uring_wait->addr),
+				     uring_wait->len, &iter);
+		if (result < 0) {
+			return result;
+		}
+		return st25r391x_write_messages(client, &iter, 1);
+	}
+	mutex_lock(&client->consumer_lock);
+	if (st25r391x_has_message(client)) {
+		result = st25r391x_read_messages(
+			client, u64_to_user_ptr(uring_wait->addr),
+			uring_wait->len);
+	} else {
+		result = -EAGAIN;
+	}
+	mutex_unlock(&client->consumer_lock);
+	return result;
+}
+
+static int st25r391x_uring_ready(struct st25r391x_uring_wait *uring_wait)
+{
+	if (uring_wait->cmd_op == NFC_URING_CMD_WRITE) {
+		return READ_ONCE(uring_wait->client->priv->running_command) ==
+		       0;
+	}
+	return st25r391x_has_message(uring_wait->client);
+}
+
+/**
+ * Remove command from the wait queue.
+ * Return whether it was queued, i.e. it was not woken in the meantime.
+ */
+static int st25r391x_uring_dequeue(struct st25r391x_uring_wait *uring_wait)
+{
+	int dequeued = 0;
+
+	spin_lock_irq(&uring_wait->head->lock);
+	if (!list_empty(&uring_wait->wait.entry)) {
+		list_del_init(&uring_wait->wait.entry);
+		dequeued = 1;
+	}
+	spin_unlock_irq(&uring_wait->head->lock);
+	return dequeued;
+}
+
+static void st25r391x_uring_task_cb(struct io_uring_cmd *ioucmd,
+				    ST25R391X_URING_TASK_CB_ARG)
+{
+	struct st25r391x_uring_wait *uring_wait = *st25r391x_uring_pdu(ioucmd);
+	ssize_t result = st25r391x_uring_try(uring_wait);
+
+	if (result == -EAGAIN) {
+		add_wait_queue(uring_wait->head, &uring_wait->wait);
+		// Wake up may have happened before command was queued.
+		if (st25r391x_uring_ready(uring_wait) &&
+		    st25r391x_uring_dequeue(uring_wait)) {
+			io_uring_cmd_complete_in_task(ioucmd,
+						      st25r391x_uring_task_cb);
+		}
+		return;
+	}
+	io_uring_cmd_done(ioucmd, result, 0,
+			  ST25R391X_URING_TASK_CB_ISSUE_FLAGS);
+	kfree(uring_wait);
+}
+
+/**
+ * Wake function, called from the polling work with the wait queue lock held.
+ */
+static int st25r391x_uring_wake(struct wait_queue_entry *wait,
+				unsigned int mode, int sync, void *key)
+{
+	struct st25r391x_uring_wait *uring_wait =
+		container_of(wait, struct st25r391x_uring_wait, wait);
+
+	list_del_init(&wait->entry);
+	io_uring_cmd_complete_in_task(uring_wait->ioucmd,
+				      st25r391x_uring_task_cb);
+	return 1;
 }
 
+static int st25r391x_uring_cmd(struct io_uring_cmd *ioucmd,
+			       unsigned int issue_flags)
+{
+	struct st25r391x_client *client =
+		(struct st25r391x_client *)ioucmd->file->private_data;
+	const struct nfc_uring_cmd *cmd = io_uring_sqe_cmd(ioucmd->sqe);
+	struct st25r391x_uring_wait *uring_wait;
+
+	if (issue_flags & IO_URING_F_CANCEL) {
+		// Commands being processed complete on their own.
+		uring_wait = *st25r391x_uring_pdu(ioucmd);
+		if (st25r391x_uring_dequeue(uring_wait)) {
+			io_uring_cmd_done(ioucmd, -ECANCELED, 0, issue_flags);
+			kfree(uring_wait);
+		}
+		return 0;
+	}
+	if (ioucmd->cmd_op != NFC_URING_CMD_READ &&
+	    ioucmd->cmd_op != NFC_URING_CMD_WRITE) {
+		return -EINVAL;
+	}
+	uring_wait = kzalloc(sizeof(*uring_wait), GFP_KERNEL);
+	if (uring_wait == NULL) {
+		return -ENOMEM;
+	}
+	init_waitqueue_func_entry(&uring_wait->wait, st25r391x_uring_wake);
+	INIT_LIST_HEAD(&uring_wait->wait.entry);
+	uring_wait->ioucmd = ioucmd;
+	uring_wait->client = client;
+	uring_wait->cmd_op = ioucmd->cmd_op;
+	// Submission queue entry is not stable after this function returns.
+	uring_wait->addr = READ_ONCE(cmd->addr);
+	uring_wait->len = READ_ONCE(cmd->len);
+	uring_wait->head = ioucmd->cmd_op == NFC_URING_CMD_WRITE ?
+				   &client->priv->write_wq :
+				   &client->read_wq;
+	*st25r391x_uring_pdu(ioucmd) = uring_wait;
+	io_uring_cmd_mark_cancelable(ioucmd, issue_flags);
+	// Process command from the submitting task, which can access its
+	// buffer, and never block the submission.
+	io_uring_cmd_complete_in_task(ioucmd, st25r391x_uring_task_cb);
+	return -EIOCBQUEUED;
+}
+#endif
+
 static unsigned int st25r391x_poll(struct file *file, poll_table *wait)
 {
-	struct st25r391x_i2c_data *priv =
-		(struct st25r391x_i2c_data *)file->private_data;
+	struct st25r391x_client *client =
+		(struct st25r391x_client *)file->private_data;
+	struct st25r391x_i2c_data *priv = client->priv;
 	unsigned int mask = 0;
 
-	poll_wait(file, &priv->read_wq, wait);
+	poll_wait(file, &client->read_wq, wait);
 	poll_wait(file, &priv->write_wq, wait);
-	spin_lock(&priv->consumer_lock);
-	if (priv->read_buffer_head != priv->read_buffer_tail) {
+	// Messages are published whole, so any byte means a whole message.
+	if (st25r391x_has_message(client) ||
+	    st25r391x_has_ring_message(client)) {
 		mask |= POLLIN | POLLRDNORM;
 	}
-	spin_unlock(&priv->consumer_lock);
-	if (priv->running_command == 0) {
+	if (READ_ONCE(priv->running_command) == 0) {
 		mask |= POLLOUT | POLLWRNORM;
 	}
 
 	return mask;
 }
 
+static int st25r391x_fasync(int fd, struct file *file, int on)
+{
+	struct st25r391x_client *client =
+		(struct st25r391x_client *)file->private_data;
+
+	return fasync_helper(fd, file, on, &client->fasync);
+}
+
+static int st25r391x_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct st25r391x_client *client =
+		(struct st25r391x_client *)file->private_data;
+	struct st25r391x_i2c_data *priv = client->priv;
+	struct nfc_event_ring_control *event_ring;
+	struct nfc_event_ring_control *new_event_ring;
+
+	if (vma->vm_pgoff != 0 ||
+	    vma->vm_end - vma->vm_start != PAGE_SIZE + NFC_EVENT_RING_SIZE) {
+		return -EINVAL;
+	}
+
+	new_event_ring = vmalloc_user(PAGE_SIZE + NFC_EVENT_RING_SIZE);
+	if (new_event_ring == NULL) {
+		return -ENOMEM;
+	}
+	new_event_ring->size = NFC_EVENT_RING_SIZE;
+	new_event_ring->data_offset = PAGE_SIZE;
+
+	// Ring may be mapped several times, keep the first one.
+	spin_lock(&priv->producer_lock);
+	event_ring = client->event_ring;
+	if (event_ring == NULL) {
+		event_ring = new_event_ring;
+		new_event_ring = NULL;
+		client->event_ring_head = 0;
+		client->event_ring = event_ring;
+	}
+	spin_unlock(&priv->producer_lock);
+	vfree(new_event_ring);
+
+	return remap_vmalloc_range(vma, event_ring, 0);
+}
+
+/**
+ * Read several messages at once into fixed size slots.
+ * Return the number of messages or an error.
+ */
+static long st25r391x_read_events(struct file *file,
+				  struct nfc_read_events_request *request)
+{
+	struct st25r391x_client *client =
+		(struct st25r391x_client *)file->private_data;
+	char __user *slots = u64_to_user_ptr(request->slots);
+	long result;
+
+	if (request->slot_size < sizeof(struct nfc_message_header_v2) ||
+	    request->max_count == 0 ||
+	    request->max_count > U32_MAX / request->slot_size) {
+		return -EINVAL;
+	}
+	if (READ_ONCE(client->event_ring)) {
+		return -EBUSY;
+	}
+	if (request->min_count > 1 && !(file->f_flags & O_NONBLOCK)) {
+		// Trade some latency for fewer wake ups.
+		if (request->timeout_ms == 0) {
+			result = wait_event_interruptible(
+				client->read_wq,
+				st25r391x_message_count(client,
+							request->min_count) ==
+					request->min_count);
+		} else {
+			result = wait_event_interruptible_timeout(
+				client->read_wq,
+				st25r391x_message_count(client,
+							request->min_count) ==
+					request->min_count,
+				msecs_to_jiffies(request->timeout_ms));
+		}
+		if (result < 0) {
+			return -ERESTARTSYS;
+		}
+	}
+	if (mutex_lock_interruptible(&client->consumer_lock)) {
+		return -ERESTARTSYS;
+	}
+	while (!st25r391x_has_message(client)) {
+		// Do not sleep while holding the lock.
+		mutex_unlock(&client->consumer_lock);
+		if (file->f_flags & O_NONBLOCK) {
+			return -EAGAIN;
+		}
+		if (wait_event_interruptible(client->read_wq,
+					     st25r391x_has_message(client))) {
+			return -ERESTARTSYS;
+		}
+		if (mutex_lock_interruptible(&client->consumer_lock)) {
+			return -ERESTARTSYS;
+		}
+	}
+	if (client->read_message_remaining) {
+		result = -EBUSY;
+	} else {
+		result = st25r391x_read_message_slots(client, slots,
+						      request->slot_size,
+						      request->max_count);
+	}
+	mutex_unlock(&client->consumer_lock);
+	return result;
+}
+
 static long st25r391x_unlocked_ioctl(struct file *file, unsigned int cmd,
 				     unsigned long arg)
 {
-	// struct st25r391x_i2c_data *priv = (struct st25r391x_i2c_data *) file->private_data;
+	struct st25r391x_client *client =
+		(struct st25r391x_client *)file->private_data;
+	struct st25r391x_i2c_data *priv = client->priv;
 	// Fixed size commands.
 	switch (cmd) {
 	case NFC_RD_GET_PROTOCOL_VERSION: {
-		uint64_t version = NFC_PROTOCOL_VERSION_1;
+		uint64_t version = client->protocol_version;
 		return copy_to_user((uint64_t *)arg, &version,
 				    sizeof(version)) ?
 				     -EFAULT :
 				     0;
 	}
+	case NFC_WR_SET_PROTOCOL_VERSION: {
+		uint64_t version;
+		long result = 0;
+		if (copy_from_user(&version, (uint64_t *)arg,
+				   sizeof(version))) {
+			return -EFAULT;
+		}
+		if (version != NFC_PROTOCOL_VERSION_1 &&
+		    version != NFC_PROTOCOL_VERSION_2) {
+			return -EINVAL;
+		}
+		// Queued messages and ring were written with current version.
+		// Broadcasts may have been queued and read already: sequence
+		// starts again with the new version.
+		spin_lock(&priv->producer_lock);
+		if (client->event_ring ||
+		    client->read_buffer_head != client->read_buffer_tail ||
+		    client->read_message_remaining) {
+			result = -EBUSY;
+		} else {
+			client->protocol_version = version;
+			client->sequence = 0;
+		}
+		spin_unlock(&priv->producer_lock);
+		return result;
+	}
+	case NFC_WR_SET_OVERFLOW_POLICY: {
+		uint32_t policy;
+		if (copy_from_user(&policy, (uint32_t *)arg, sizeof(policy))) {
+			return -EFAULT;
+		}
+		if (policy != NFC_OVERFLOW_POLICY_DROP_NEWEST &&
+		    policy != NFC_OVERFLOW_POLICY_DROP_OLDEST &&
+		    policy != NFC_OVERFLOW_POLICY_COALESCE) {
+			return -EINVAL;
+		}
+		spin_lock(&priv->producer_lock);
+		client->overflow_policy = policy;
+		spin_unlock(&priv->producer_lock);
+		return 0;
+	}
+	case NFC_WR_SET_BUFFER_SIZE: {
+		uint32_t size;
+		char *read_buffer;
+		long result = 0;
+		if (copy_from_user(&size, (uint32_t *)arg, sizeof(size))) {
+			return -EFAULT;
+		}
+		size = st25r391x_read_buffer_size(size);
+		read_buffer = kvmalloc(size, GFP_KERNEL);
+		if (read_buffer == NULL) {
+			return -ENOMEM;
+		}
+		// Exclude readers, and producer as buffer must be empty.
+		mutex_lock(&client->consumer_lock);
+		spin_lock(&priv->producer_lock);
+		if (client->read_buffer_head != client->read_buffer_tail) {
+			result = -EBUSY;
+		} else {
+			swap(client->read_buffer, read_buffer);
+			client->read_buffer_size = size;
+			client->read_buffer_head = 0;
+			client->read_buffer_tail = 0;
+		}
+		spin_unlock(&priv->producer_lock);
+		mutex_unlock(&client->consumer_lock);
+		kvfree(read_buffer);
+		return result;
+	}
+	case NFC_WR_SET_EVENTFD: {
+		struct nfc_eventfd_request request;
+		struct eventfd_ctx *eventfd = NULL;
+		if (copy_from_user(&request,
+				   (struct nfc_eventfd_request *)arg,
+				   sizeof(request))) {
+			return -EFAULT;
+		}
+		if (request.fd >= 0) {
+			eventfd = eventfd_ctx_fdget(request.fd);
+			if (IS_ERR(eventfd)) {
+				return PTR_ERR(eventfd);
+			}
+		}
+		spin_lock(&priv->producer_lock);
+		swap(client->eventfd, eventfd);
+		client->eventfd_message_types =
+			request.message_types ? request.message_types : U64_MAX;
+		spin_unlock(&priv->producer_lock);
+		if (eventfd) {
+			eventfd_ctx_put(eventfd);
+		}
+		return 0;
+	}
+	case NFC_RD_READ_EVENTS: {
+		struct nfc_read_events_request request;
+		if (copy_from_user(&request,
+				   (struct nfc_read_events_request *)arg,
+				   sizeof(request))) {
+			return -EFAULT;
+		}
+		return st25r391x_read_events(file, &request);
+	}
 	}
 
 	return -ENOIOCTLCMD;
 }
 
+// ========================================================================== //
+// Statistics
+// ========================================================================== //
+
+static ssize_t memory_bytes_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct st25r391x_i2c_data *priv = dev_get_drvdata(dev);
+	struct st25r391x_client *client;
+	size_t memory_bytes = 0;
+
+	mutex_lock(&priv->command_lock);
+	if (priv->mode_params) {
+		memory_bytes = sizeof(*priv->mode_params);
+	}
+	spin_lock(&priv->producer_lock);
+	list_for_each_entry(client, &priv->clients, list) {
+		memory_bytes += sizeof(*client) + client->read_buffer_size;
+		if (client->event_ring) {
+			memory_bytes += PAGE_SIZE + NFC_EVENT_RING_SIZE;
+		}
+	}
+	spin_unlock(&priv->producer_lock);
+	mutex_unlock(&priv->command_lock);
+	return sysfs_emit(buf, "%zu\n", memory_bytes);
+}
+static DEVICE_ATTR_RO(memory_bytes);
+
+static ssize_t clients_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	struct st25r391x_i2c_data *priv = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%d\n", READ_ONCE(priv->client_count));
+}
+static DEVICE_ATTR_RO(clients);
+
+#define ST25R391X_POWER_STAT_ATTR(name)                                      \
+	static ssize_t name##_show(struct device *dev,                       \
+				   struct device_attribute *attr, char *buf) \
+	{                                                                    \
+		struct st25r391x_i2c_data *priv = dev_get_drvdata(dev);      \
+                                                                             \
+		return sysfs_emit(buf, "%u\n",                               \
+				  READ_ONCE(priv->power_stats.name));        \
+	}                                                                    \
+	static DEVICE_ATTR_RO(name)
+
+ST25R391X_POWER_STAT_ATTR(oscillator_starts);
+ST25R391X_POWER_STAT_ATTR(oscillator_start_skips);
+ST25R391X_POWER_STAT_ATTR(regulator_adjusts);
+ST25R391X_POWER_STAT_ATTR(regulator_adjust_skips);
+ST25R391X_POWER_STAT_ATTR(supply_drifts);
+ST25R391X_POWER_STAT_ATTR(wake_up_entries);
+ST25R391X_POWER_STAT_ATTR(wake_ups);
+ST25R391X_POWER_STAT_ATTR(i2c_transactions);
+ST25R391X_POWER_STAT_ATTR(prescreen_skips);
+ST25R391X_POWER_STAT_ATTR(prescreen_polls);
+ST25R391X_POWER_STAT_ATTR(prescreen_misses);
+ST25R391X_POWER_STAT_ATTR(external_field_backoffs);
+ST25R391X_POWER_STAT_ATTR(runtime_suspends);
+ST25R391X_POWER_STAT_ATTR(runtime_resumes);
+ST25R391X_POWER_STAT_ATTR(resume_latency_us);
+ST25R391X_POWER_STAT_ATTR(resume_latency_max_us);
+
+static struct attribute *st25r391x_stats_attrs[] = {
+	&dev_attr_memory_bytes.attr,
+	&dev_attr_clients.attr,
+	&dev_attr_oscillator_starts.attr,
+	&dev_attr_oscillator_start_skips.attr,
+	&dev_attr_regulator_adjusts.attr,
+	&dev_attr_regulator_adjust_skips.attr,
+	&dev_attr_supply_drifts.attr,
+	&dev_attr_wake_up_entries.attr,
+	&dev_attr_wake_ups.attr,
+	&dev_attr_i2c_transactions.attr,
+	&dev_attr_prescreen_skips.attr,
+	&dev_attr_prescreen_polls.attr,
+	&dev_attr_prescreen_misses.attr,
+	&dev_attr_external_field_backoffs.attr,
+	&dev_attr_runtime_suspends.attr,
+	&dev_attr_runtime_resumes.attr,
+	&dev_attr_resume_latency_us.attr,
+	&dev_attr_resume_latency_max_us.attr,
+	NULL,
+};
+
+static const struct attribute_group st25r391x_stats_group = {
+	.name = "stats",
+	.attrs = st25r391x_stats_attrs,
+};
+
+static const struct attribute_group *st25r391x_groups[] = {
+	&st25r391x_stats_group,
+	NULL,
+};
+
 static struct file_operations st25r391x_fops = {
 	.owner = THIS_MODULE,
 	.open = st25r391x_open,
 	.read = st25r391x_read,
-	.write = st25r391x_write,
+	.write_iter = st25r391x_write_iter,
 	.release = st25r391x_release,
 	.poll = st25r391x_poll,
+	.mmap = st25r391x_mmap,
+	.fasync = st25r391x_fasync,
 	.unlocked_ioctl = st25r391x_unlocked_ioctl,
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 5, 0)
 	.compat_ioctl = compat_ptr_ioctl,
 #endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	.uring_cmd = st25r391x_uring_cmd,
+#endif
 };
 
 // ========================================================================== //
 // Probing, initialization and cleanup
 // ========================================================================== //
 
-static int st25r391x_i2c_probe(struct i2c_client *i2c,
-			       const struct i2c_device_id *id)
+/**
+ * Configure the chip as after power on. Called on probe and system resume.
+ */
+static int st25r391x_chip_init(struct i2c_client *i2c)
 {
 	struct device *dev = &i2c->dev;
-	struct st25r391x_i2c_data *priv;
-	int err;
 	s32 result;
 	u8 buffer[2];
 
-	priv = devm_kzalloc(dev, sizeof(*priv), GFP_KERNEL);
-	if (!priv)
-		return -ENOMEM;
-
 	// Set default
 	result = st25r391x_direct_command(i2c,
 					  ST25R391X_SET_DEFAULT_COMMAND_CODE);
 	if (result < 0) {
 		dev_err(dev,
-			"st25r391x_i2c_probe: Failed to send set default command %d",
+			"st25r391x_chip_init: Failed to send set default command %d",
 			result);
 		return result;
 	}
@@ -753,7 +2265,7 @@ static int st25r391x_i2c_probe(struct i2c_client *i2c,
 		i2c, ST25R391X_TEST_ACCESS_COMMAND_CODE, 2, buffer);
 	if (result < 0) {
 		dev_err(dev,
-			"st25r391x_i2c_probe: Failed to write test register %d",
+			"st25r391x_chip_init: Failed to write test register %d",
 			result);
 		return result;
 	}
@@ -763,7 +2275,7 @@ static int st25r391x_i2c_probe(struct i2c_client *i2c,
 		i2c, ST25R391X_IO_CONFIGURATION_1_REGISTER, 2, 0, 0b00100000);
 	if (result < 0) {
 		dev_err(dev,
-			"st25r391x_i2c_probe: Failed to write IO Configuration Registers %d",
+			"st25r391x_chip_init: Failed to write IO Configuration Registers %d",
 			result);
 		return result;
 	}
@@ -776,7 +2288,7 @@ static int st25r391x_i2c_probe(struct i2c_client *i2c,
 	}
 	if (result != 0b00101010) {
 		dev_err(dev,
-			"st25r391x_i2c_probe: Unexpected identity register value %d",
+			"st25r391x_chip_init: Unexpected identity register value %d",
 			result);
 		return -1;
 	}
@@ -786,7 +2298,7 @@ static int st25r391x_i2c_probe(struct i2c_client *i2c,
 		i2c, ST25R391X_REGULATOR_VOLTAGE_CONTROL_REGISTER, 0b11110000);
 	if (result < 0) {
 		dev_err(dev,
-			"st25r391x_i2c_probe: Failed to write regulator voltage control register: %d",
+			"st25r391x_chip_init: Failed to write regulator voltage control register: %d",
 			result);
 		return result;
 	}
@@ -794,13 +2306,37 @@ static int st25r391x_i2c_probe(struct i2c_client *i2c,
 		i2c, ST25R391X_REGULATOR_VOLTAGE_CONTROL_REGISTER, 0b01110000);
 	if (result < 0) {
 		dev_err(dev,
-			"st25r391x_i2c_probe: Failed to write regulator voltage control register: %d",
+			"st25r391x_chip_init: Failed to write regulator voltage control register: %d",
 			result);
 		return result;
 	}
 
+	return 0;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+static int st25r391x_i2c_probe(struct i2c_client *i2c)
+#else
+static int st25r391x_i2c_probe(struct i2c_client *i2c,
+			       const struct i2c_device_id *id)
+#endif
+{
+	struct device *dev = &i2c->dev;
+	struct st25r391x_i2c_data *priv;
+	int err;
+	s32 result;
+
+	priv = devm_kzalloc(dev, sizeof(*priv), GFP_KERNEL);
+	if (!priv)
+		return -ENOMEM;
+
+	result = st25r391x_chip_init(i2c);
+	if (result < 0)
+		return result;
+
 	i2c_set_clientdata(i2c, priv);
 	priv->i2c = i2c;
+	priv->reader_only = reader_only;
 
 	timer_setup(&priv->polling_timer, st25r391x_polling_timer_cb, 0);
 
@@ -815,7 +2351,11 @@ static int st25r391x_i2c_probe(struct i2c_client *i2c,
 	}
 
 	// Create device class
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+	priv->st25r391x_class = class_create(DEVICE_NAME);
+#else
 	priv->st25r391x_class = class_create(THIS_MODULE, DEVICE_NAME);
+#endif
 	if (IS_ERR(priv->st25r391x_class)) {
 		err = PTR_ERR(priv->st25r391x_class);
 		dev_err(dev, "st25r391x_i2c_probe: class_create failed: %d",
@@ -834,10 +2374,9 @@ static int st25r391x_i2c_probe(struct i2c_client *i2c,
 		return err;
 	}
 
-	priv->device = device_create(priv->st25r391x_class, dev, priv->chrdev,
-				     NULL,
-				     /* no additional data */ DEVICE_NAME "%d",
-				     MINOR(priv->chrdev));
+	priv->device = device_create_with_groups(
+		priv->st25r391x_class, dev, priv->chrdev, priv,
+		st25r391x_groups, DEVICE_NAME "%d", MINOR(priv->chrdev));
 	if (IS_ERR(priv->device)) {
 		err = PTR_ERR(priv->device);
 		dev_err(dev, "st25r391x_i2c_probe: Failed to create device: %d",
@@ -847,16 +2386,29 @@ static int st25r391x_i2c_probe(struct i2c_client *i2c,
 	}
 
 	spin_lock_init(&priv->producer_lock);
-	spin_lock_init(&priv->consumer_lock);
+	INIT_LIST_HEAD(&priv->clients);
 	mutex_init(&priv->command_lock);
-	init_waitqueue_head(&priv->read_wq);
 	init_waitqueue_head(&priv->write_wq);
 	INIT_WORK(&priv->polling_work, st25r391x_do_poll);
+	INIT_DELAYED_WORK(&priv->oscillator_off_work, st25r391x_oscillator_off);
+
+	// Chip is active until it is idle for autosuspend_ms.
+	pm_runtime_get_noresume(dev);
+	pm_runtime_set_active(dev);
+	pm_runtime_set_autosuspend_delay(dev, READ_ONCE(autosuspend_ms));
+	pm_runtime_use_autosuspend(dev);
+	pm_runtime_enable(dev);
+	pm_runtime_mark_last_busy(dev);
+	pm_runtime_put_autosuspend(dev);
 
 	return 0;
 }
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 1, 0)
+static void st25r391x_i2c_remove(struct i2c_client *client)
+#else
 static int st25r391x_i2c_remove(struct i2c_client *client)
+#endif
 {
 	struct st25r391x_i2c_data *priv;
 	priv = i2c_get_clientdata(client);
@@ -874,12 +2426,133 @@ static int st25r391x_i2c_remove(struct i2c_client *client)
 		unregister_chrdev_region(priv->chrdev, 2);
 	}
 
-	del_timer_sync(&priv->polling_timer);
+	pm_runtime_disable(&client->dev);
+	pm_runtime_dont_use_autosuspend(&client->dev);
+	pm_runtime_set_suspended(&client->dev);
+
+	timer_delete_sync(&priv->polling_timer);
+	cancel_work_sync(&priv->polling_work);
+	cancel_delayed_work_sync(&priv->oscillator_off_work);
+	if (priv->oscillator_on) {
+		(void)st25r391x_power_down(priv);
+	}
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 1, 0)
+	return 0;
+#endif
+}
+
+// ========================================================================== //
+// Power management
+// ========================================================================== //
+
+/**
+ * Power chip down once reader has been idle for autosuspend delay.
+ * Runs while command_lock may be held by a writer waiting for the device, so
+ * it only tries to take it: suspend is retried after autosuspend delay.
+ */
+static int __maybe_unused st25r391x_runtime_suspend(struct device *dev)
+{
+	struct st25r391x_i2c_data *priv =
+		i2c_get_clientdata(to_i2c_client(dev));
+
+	if (!mutex_trylock(&priv->command_lock)) {
+		pm_runtime_mark_last_busy(dev);
+		return -EBUSY;
+	}
+	if (priv->mode != mode_idle) {
+		mutex_unlock(&priv->command_lock);
+		return -EBUSY;
+	}
+	// Oscillator off work takes the lock, so it cannot be waited for here.
+	// If already running, it does nothing once chip is powered down.
+	cancel_delayed_work(&priv->oscillator_off_work);
+	(void)st25r391x_power_down(priv);
+	priv->power_stats.runtime_suspends++;
+	mutex_unlock(&priv->command_lock);
+	return 0;
+}
+
+/**
+ * Make sure chip is usable, configuring it again if it lost power.
+ * Like suspend, runs without command_lock.
+ */
+static int __maybe_unused st25r391x_runtime_resume(struct device *dev)
+{
+	struct i2c_client *i2c = to_i2c_client(dev);
+	struct st25r391x_i2c_data *priv = i2c_get_clientdata(i2c);
+	ktime_t start = ktime_get();
+	s32 result;
+	u32 latency_us;
+
+	result = st25r391x_read_register_byte(i2c,
+					      ST25R391X_IC_IDENTITY_REGISTER);
+	if (result != 0b00101010) {
+		result = st25r391x_chip_init(i2c);
+		WRITE_ONCE(priv->chip_reset, true);
+		if (result < 0)
+			return result;
+	}
+	latency_us = ktime_us_delta(ktime_get(), start);
+	priv->power_stats.runtime_resumes++;
+	priv->power_stats.resume_latency_us = latency_us;
+	if (latency_us > priv->power_stats.resume_latency_max_us)
+		priv->power_stats.resume_latency_max_us = latency_us;
+	return 0;
+}
+
+static int __maybe_unused st25r391x_suspend(struct device *dev)
+{
+	struct st25r391x_i2c_data *priv =
+		i2c_get_clientdata(to_i2c_client(dev));
+
+	// Polling work restarts the timer.
+	stop_polling_timer(priv);
 	cancel_work_sync(&priv->polling_work);
+	stop_polling_timer(priv);
+	cancel_delayed_work_sync(&priv->oscillator_off_work);
 
+	mutex_lock(&priv->command_lock);
+	(void)st25r391x_power_down(priv);
+	mutex_unlock(&priv->command_lock);
 	return 0;
 }
 
+/**
+ * Restore chip configuration, which may have been lost during system sleep,
+ * and resume polling. Selected tags are lost as field was off.
+ */
+static int __maybe_unused st25r391x_resume(struct device *dev)
+{
+	struct i2c_client *i2c = to_i2c_client(dev);
+	struct st25r391x_i2c_data *priv = i2c_get_clientdata(i2c);
+	int result;
+
+	result = st25r391x_chip_init(i2c);
+	if (result < 0)
+		return result;
+
+	mutex_lock(&priv->command_lock);
+	priv->regulator.valid = 0;
+	priv->field_guard_timer_valid = 0;
+	priv->select_field_kept = 0;
+	priv->external_field = 0;
+	if (priv->mode == mode_discover || priv->mode == mode_select) {
+		restart_polling_timer(priv);
+	} else if (priv->mode != mode_idle) {
+		st25r391x_transition_to_idle(priv);
+		priv->running_command = 0;
+		wake_up_interruptible(&priv->write_wq);
+	}
+	mutex_unlock(&priv->command_lock);
+	return 0;
+}
+
+static const struct dev_pm_ops st25r391x_pm_ops = {
+	SET_SYSTEM_SLEEP_PM_OPS(st25r391x_suspend, st25r391x_resume)
+		SET_RUNTIME_PM_OPS(st25r391x_runtime_suspend,
+				   st25r391x_runtime_resume, NULL)
+};
+
 #ifdef CONFIG_OF
 static const struct of_device_id st25r391x_i2c_ids[] = {
 	{
@@ -894,12 +2567,32 @@ static struct i2c_driver st25r391x_i2c_driver = {
     .driver = {
         .name = DRV_NAME,
         .of_match_table = of_match_ptr(st25r391x_i2c_ids),
+        .pm = &st25r391x_pm_ops,
     },
     .probe              = st25r391x_i2c_probe,
     .remove             = st25r391x_i2c_remove,
 };
 
-module_i2c_driver(st25r391x_i2c_driver);
+static int __init st25r391x_init(void)
+{
+	int result;
+
+	result = st25r391x_netlink_register();
+	if (result < 0)
+		return result;
+	result = i2c_add_driver(&st25r391x_i2c_driver);
+	if (result < 0)
+		st25r391x_netlink_unregister();
+	return result;
+}
+module_init(st25r391x_init);
+
+static void __exit st25r391x_exit(void)
+{
+	i2c_del_driver(&st25r391x_i2c_driver);
+	st25r391x_netlink_unregister();
+}
+module_exit(st25r391x_exit);
 
 MODULE_DESCRIPTION("STMicroelectronics ST25R3916/7 Driver");
 MODULE_AUTHOR("Paul Guyot <pguyot@kallisys.net>");
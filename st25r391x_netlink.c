@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: GPL-2.0+ WITH Linux-syscall-note */
+/*
+ * ST25R3916/7 NFC Reader Driver
+ *
+ * Copyright (C) 2020-2022 Paul Guyot <pguyot@kallisys.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA
+ */
+
+
+#include <linux/types.h>
+#include <linux/kdev_t.h>
+#include <linux/module.h>
+#include <net/genetlink.h>
+
+#include "nfc.h"
+
+#include "st25r391x.h"
+#include "st25r391x_netlink.h"
+
+static const struct genl_multicast_group st25r391x_netlink_groups[] = {
+	[NFC_GENL_GROUP_ISO14443A] = { .name = NFC_GENL_GROUP_ISO14443A_NAME },
+	[NFC_GENL_GROUP_ISO14443B] = { .name = NFC_GENL_GROUP_ISO14443B_NAME },
+	[NFC_GENL_GROUP_ST25TB] = { .name = NFC_GENL_GROUP_ST25TB_NAME },
+	[NFC_GENL_GROUP_NFCF] = { .name = NFC_GENL_GROUP_NFCF_NAME },
+	[NFC_GENL_GROUP_ISO15693] = { .name = NFC_GENL_GROUP_ISO15693_NAME },
+};
+
+static struct genl_family st25r391x_netlink_family = {
+	.name = NFC_GENL_FAMILY_NAME,
+	.version = NFC_GENL_VERSION,
+	.maxattr = NFC_GENL_ATTR_MAX,
+	.module = THIS_MODULE,
+	.mcgrps = st25r391x_netlink_groups,
+	.n_mcgrps = ARRAY_SIZE(st25r391x_netlink_groups),
+};
+
+int st25r391x_netlink_register(void)
+{
+	return genl_register_family(&st25r391x_netlink_family);
+}
+
+void st25r391x_netlink_unregister(void)
+{
+	genl_unregister_family(&st25r391x_netlink_family);
+}
+
+/**
+ * Determine the multicast group of a tag type, or -1 if there is none.
+ */
+static int st25r391x_netlink_group(u8 tag_type)
+{
+	switch (tag_type) {
+	case NFC_TAG_TYPE_ISO14443A:
+	case NFC_TAG_TYPE_ISO14443A_T2T:
+	case NFC_TAG_TYPE_MIFARE_CLASSIC:
+	case NFC_TAG_TYPE_ISO14443A_NFCDEP:
+	case NFC_TAG_TYPE_ISO14443A_T4T:
+	case NFC_TAG_TYPE_ISO14443A_T4T_NFCDEP:
+	case NFC_TAG_TYPE_ISO14443A_T1T:
+		return NFC_GENL_GROUP_ISO14443A;
+	case NFC_TAG_TYPE_ISO14443B:
+		return NFC_GENL_GROUP_ISO14443B;
+	case NFC_TAG_TYPE_ST25TB:
+		return NFC_GENL_GROUP_ST25TB;
+	case NFC_TAG_TYPE_NFCF:
+	case NFC_TAG_TYPE_NFCF_NFCDEP:
+		return NFC_GENL_GROUP_NFCF;
+	case NFC_TAG_TYPE_ISO15693:
+	case NFC_TAG_TYPE_ISO15693_ST25XV:
+		return NFC_GENL_GROUP_ISO15693;
+	}
+	return -1;
+}
+
+void st25r391x_netlink_tag_event(struct st25r391x_i2c_data *priv, u8 command,
+				 u8 tag_type, const u8 *uid, u8 uid_len,
+				 const void *tag_info, u16 tag_info_len,
+				 u64 timestamp_ns)
+{
+	int group = st25r391x_netlink_group(tag_type);
+	struct sk_buff *skb;
+	void *header;
+
+	// Only pay for the message if someone listens to this technology.
+	if (group < 0 || !genl_has_listeners(&st25r391x_netlink_family,
+					     &init_net, group)) {
+		return;
+	}
+	skb = genlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+	if (skb == NULL) {
+		return;
+	}
+	do {
+		header = genlmsg_put(skb, 0, 0, &st25r391x_netlink_family, 0,
+				     command);
+		if (header == NULL)
+			break;
+		if (nla_put_u32(skb, NFC_GENL_ATTR_READER,
+				new_encode_dev(priv->chrdev)) ||
+		    nla_put_u64_64bit(skb, NFC_GENL_ATTR_TIMESTAMP,
+				      timestamp_ns, NFC_GENL_ATTR_PAD) ||
+		    nla_put_u8(skb, NFC_GENL_ATTR_TAG_TYPE, tag_type) ||
+		    nla_put(skb, NFC_GENL_ATTR_UID, uid_len, uid))
+			break;
+		if (tag_info &&
+		    nla_put(skb, NFC_GENL_ATTR_TAG_INFO, tag_info_len, tag_info))
+			break;
+		genlmsg_end(skb, header);
+		genlmsg_multicast(&st25r391x_netlink_family, skb, 0, group,
+				  GFP_KERNEL);
+		return;
+	} while (0);
+	nlmsg_free(skb);
+}
@@ -19,6 +19,7 @@
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA
  */
 
+#include <linux/delay.h>
 #include <linux/types.h>
 #include <linux/i2c.h>
 #include <linux/string.h>
@@ -34,6 +35,21 @@
 #include "st25r391x_registers.h"
 #include "st25r391x.h"
 
+// ISO-14443-A commands
+#define ISO14443A_COMMAND_HLTA 0x50
+
+// ISO-14443-4 S(DESELECT) block, without CID
+#define ISO14443_4_S_DESELECT 0xC2
+
+// Number of bits of UID CLn and BCC, resolved at each cascade level
+#define ISO14443A_CASCADE_LEVEL_BITS 40
+
+enum st25r391x_nfca_collision {
+	nfca_no_collision,
+	nfca_bit_collision,
+	nfca_parity_collision,
+};
+
 static s32 st25r391x_set_iso14443a_mode(struct i2c_client *i2c)
 {
 	s32 result;
@@ -73,15 +89,29 @@ static s32 st25r391x_set_iso14443a_mode(struct i2c_client *i2c)
 	return result;
 }
 
+/**
+ * Send an anticollision frame of bits_count bits and receive the answer.
+ * Return the number of bits received before any collision, which is reported
+ * in collision. A collision in a parity bit is reported on the last bit of
+ * the byte as the data bits did not collide.
+ * When bits_count is not a multiple of 8, the answer completes the split byte:
+ * its first bits are stored in rx_buf at their position within that byte,
+ * after bits_count % 8 bits that are not part of the answer.
+ */
 static s32 st25r391x_nfca_transceive_anticollision_frame(
 	struct i2c_client *i2c, struct st25r391x_interrupts *ints,
-	const u8 *tx_buf, u8 bits_count, u8 *rx_buf)
+	const u8 *tx_buf, u8 bits_count, u8 *rx_buf,
+	enum st25r391x_nfca_collision *collision)
 {
 	s32 result;
 	u8 bytes_in_fifo;
 	u8 fifo_flags;
+	u8 main_flags;
+	u8 collision_display;
 	u8 received_bits;
+	u8 align = bits_count & 0x7;
 
+	*collision = nfca_no_collision;
 	do {
 		result = st25r391x_direct_command(
 			i2c, ST25R391X_CLEAR_FIFO_COMMAND_CODE);
@@ -110,7 +140,8 @@ static s32 st25r391x_nfca_transceive_anticollision_frame(
 			ints,
 			ST25R391X_MAIN_INTERRUPT_REGISTER_l_txe |
 				ST25R391X_MAIN_INTERRUPT_REGISTER_l_rxs |
-				ST25R391X_MAIN_INTERRUPT_REGISTER_l_rxe,
+				ST25R391X_MAIN_INTERRUPT_REGISTER_l_rxe |
+				ST25R391X_MAIN_INTERRUPT_REGISTER_l_col,
 			0, 0, 0);
 
 		result = st25r391x_direct_command(
@@ -120,41 +151,34 @@ static s32 st25r391x_nfca_transceive_anticollision_frame(
 
 		result = st25r391x_polling_wait_for_interrupt_bit(
 			i2c, ints, ST25R391X_MAIN_INTERRUPT_REGISTER_l_txe, 0,
-			0, 0, 5000); // TODO: fix timeout
+			0, 0, ST25R391X_FRAME_USEC(bytes_in_fifo));
 		if (result < 0)
 			break;
 		// Receive data
 		result = st25r391x_polling_wait_for_interrupt_bit(
 			i2c, ints, ST25R391X_MAIN_INTERRUPT_REGISTER_l_rxs, 0,
-			0, 0, 5000); // TODO: fix timeout
+			0, 0, ST25R391X_NFCA_FDT_USEC);
 		if (result < 0)
 			break;
+		// Interrupt register is cleared on read: catch l_col before it
+		// is overwritten by the read with l_rxe.
 		result = st25r391x_polling_wait_for_interrupt_bit(
-			i2c, ints, ST25R391X_MAIN_INTERRUPT_REGISTER_l_rxe, 0,
-			0, 0, 5000); // TODO: fix timeout
+			i2c, ints,
+			ST25R391X_MAIN_INTERRUPT_REGISTER_l_rxe |
+				ST25R391X_MAIN_INTERRUPT_REGISTER_l_col,
+			0, 0, 0, ST25R391X_FRAME_USEC(5));
 		if (result < 0)
 			break;
-		result = st25r391x_read_register_byte(
-			i2c, ST25R391X_COLLISION_DISPLAY_REGISTER);
-		if (result < 0)
-			break;
-		if (result & ST25R391X_COLLISION_DISPLAY_REGISTER_c_pb) {
-			dev_err(&i2c->dev,
-				"Collision in parity bit (unimplemeted) => %#2x",
-				result);
-			result = -1; // Collision in parity bit
-			break;
-		}
-		received_bits = (result >> 1);
-		if (received_bits < bits_count) {
-			dev_err(&i2c->dev,
-				"st25r391x_nfca_transceive_anticollision_frame: collision happened after %d bits, expected at least %d (what we sent)",
-				received_bits, bits_count);
-			result = -1;
-			break;
+		main_flags = ints->flags[ST25R391X_MAIN_INTERRUPT_REGISTER -
+					 ST25R391X_MAIN_INTERRUPT_REGISTER];
+		if (!(main_flags & ST25R391X_MAIN_INTERRUPT_REGISTER_l_rxe)) {
+			result = st25r391x_polling_wait_for_interrupt_bit(
+				i2c, ints,
+				ST25R391X_MAIN_INTERRUPT_REGISTER_l_rxe, 0, 0,
+				0, ST25R391X_FRAME_USEC(5));
+			if (result < 0)
+				break;
 		}
-		received_bits -=
-			bits_count; // received_bits from collision display register
 		result = st25r391x_read_fifo(i2c, 5, rx_buf, &fifo_flags);
 		if (result < 0) {
 			dev_err(&i2c->dev,
@@ -165,18 +189,77 @@ static s32 st25r391x_nfca_transceive_anticollision_frame(
 		if (fifo_flags & 0x0E) {
 			result = result - 8 + ((fifo_flags & 0x0E) >> 1);
 		}
+		// First FIFO bits are the split byte bits we sent.
+		if (result < align) {
+			dev_err(&i2c->dev,
+				"st25r391x_nfca_transceive_anticollision_frame: read %d bits from FIFO, expected at least %d",
+				result, align);
+			result = -1;
+			break;
+		}
+		result -= align;
+		if (!(main_flags & ST25R391X_MAIN_INTERRUPT_REGISTER_l_col)) {
+			break;
+		}
+
+		received_bits = result;
+		result = st25r391x_read_register_byte(
+			i2c, ST25R391X_COLLISION_DISPLAY_REGISTER);
+		if (result < 0)
+			break;
+		collision_display = result;
+		if (collision_display &
+		    ST25R391X_COLLISION_DISPLAY_REGISTER_c_pb) {
+			if (received_bits == 0) {
+				result = -1;
+				break;
+			}
+			*collision = nfca_parity_collision;
+			result = received_bits - 1;
+			break;
+		}
+		// Position counts bits from the start of the frame we sent
+		result = collision_display >> 1;
+		if (result < bits_count) {
+			dev_err(&i2c->dev,
+				"st25r391x_nfca_transceive_anticollision_frame: collision happened after %d bits, expected at least %d (what we sent)",
+				result, bits_count);
+			result = -1;
+			break;
+		}
+		result -= bits_count;
 		if (received_bits != result) {
 			dev_err(&i2c->dev,
 				"st25r391x_nfca_transceive_anticollision_frame: read %d bits from FIFO, expected %d",
-				result, received_bits);
+				received_bits, result);
 			result = -1;
 			break;
 		}
+		*collision = nfca_bit_collision;
 	} while (0);
 
 	return result;
 }
 
+/**
+ * Return interface byte TB(1) of the ATS, or its default value (FWI = 4,
+ * SFGI = 0) if it is absent.
+ */
+static u8 st25r391x_nfca_ats_tb(const struct nfc_tag_info_iso14443a4 *tag_info)
+{
+	u8 tb_index;
+
+	if (tag_info->ats_len == 0 || !(tag_info->ats[0] & 0x20)) {
+		return ST25R391X_ISO14443_DEFAULT_FWI << 4;
+	}
+	// T0 is followed by TA(1) if present, then TB(1)
+	tb_index = tag_info->ats[0] & 0x10 ? 2 : 1;
+	if (tb_index >= tag_info->ats_len) {
+		return ST25R391X_ISO14443_DEFAULT_FWI << 4;
+	}
+	return tag_info->ats[tb_index];
+}
+
 static s32 st25r391x_nfca_rats(struct st25r391x_i2c_data *priv,
 			       struct nfc_tag_info_iso14443a4 *tag_info)
 {
@@ -190,12 +273,20 @@ static s32 st25r391x_nfca_rats(struct st25r391x_i2c_data *priv,
 	buffer[1] = 0x80;
 	result = st25r391x_transceive_frame(i2c, ints, buffer, 2, buffer,
 					    sizeof(buffer), 0,
-					    5000); // TODO: check rx timeout
+					    ST25R391X_NFCA_ATS_FWT_USEC);
 	if (result >= 0) {
 		if (result == buffer[0] + 2) {
+			u32 sfgt_usec;
+
 			tag_info->ats_len = buffer[0] - 1;
 			memcpy(tag_info->ats, (const void *)(buffer + 1),
 			       tag_info->ats_len);
+			// Tag may need a guard time before the next frame.
+			sfgt_usec = st25r391x_iso14443_sfgt_usec(
+				st25r391x_nfca_ats_tb(tag_info) & 0x0F);
+			if (sfgt_usec) {
+				usleep_range(sfgt_usec, sfgt_usec + 100);
+			}
 		} else {
 			dev_err(priv->device,
 				"st25r391x_nfca_rats: Incorrect TL byte for ATS, expected %d got %d",
@@ -215,6 +306,9 @@ static s32 st25r391x_nfca_do_select(struct st25r391x_i2c_data *priv,
 	u8 cascade_level = 1;
 	u8 known_bits = 0;
 	u8 uid[15];
+	enum st25r391x_nfca_collision collision;
+	// Bit set to 1 after a parity collision, to set to 0 if no tag answers
+	s16 guessed_bit = -1;
 
 	u8 index_bits;
 
@@ -243,14 +337,27 @@ static s32 st25r391x_nfca_do_select(struct st25r391x_i2c_data *priv,
 					    index_byte];
 			}
 			result = st25r391x_nfca_transceive_anticollision_frame(
-				i2c, ints, buffer, 16 + known_bits, buffer);
+				i2c, ints, buffer, 16 + known_bits, buffer,
+				&collision);
+			if (result < 0 && guessed_bit >= 0) {
+				// Take the other branch
+				uid[(cascade_level - 1) * 5 +
+				    guessed_bit / 8] &=
+					~(1 << (guessed_bit & 0x07));
+				guessed_bit = -1;
+				continue;
+			}
 			if (result < 0)
 				break;
+			guessed_bit = -1;
 
+			// Received bits of the split byte keep their position.
 			for (index_bits = 0; index_bits < result;
 			     index_bits++) {
-				u8 index_byte_buffer = index_bits / 8;
-				u8 index_within_byte_buffer = index_bits & 0x07;
+				u8 index_byte_buffer =
+					((known_bits & 0x07) + index_bits) / 8;
+				u8 index_within_byte_buffer =
+					(known_bits + index_bits) & 0x07;
 				u8 index_byte_uid =
 					(cascade_level - 1) * 5 +
 					(known_bits + index_bits) / 8;
@@ -266,7 +373,18 @@ static s32 st25r391x_nfca_do_select(struct st25r391x_i2c_data *priv,
 				}
 			}
 			known_bits += result;
-			if (known_bits < 40) {
+			if (collision != nfca_no_collision &&
+			    known_bits < ISO14443A_CASCADE_LEVEL_BITS) {
+				// Follow the branch of tags with a 1 at the
+				// collision, others are resolved once these are
+				// halted.
+				uid[(cascade_level - 1) * 5 + known_bits / 8] |=
+					1 << (known_bits & 0x07);
+				if (collision == nfca_parity_collision)
+					guessed_bit = known_bits;
+				known_bits++;
+			}
+			if (known_bits < ISO14443A_CASCADE_LEVEL_BITS) {
 				continue; // Fetch more bits.
 			}
 
@@ -287,7 +405,7 @@ static s32 st25r391x_nfca_do_select(struct st25r391x_i2c_data *priv,
 			buffer[6] = uid[(cascade_level - 1) * 5 + 4];
 			result = st25r391x_transceive_frame(
 				i2c, ints, buffer, 7, buffer, sizeof(buffer), 0,
-				5000); // TODO: check rx timeout
+				ST25R391X_NFCA_FDT_USEC);
 			if (result < 0)
 				break;
 
@@ -391,12 +509,12 @@ static s32 st25r391x_nfca_do_select(struct st25r391x_i2c_data *priv,
 					tag_info->uid[7] = uid[11];
 					tag_info->uid[8] = uid[12];
 					tag_info->uid[9] = uid[13];
-					tag_info->uid_len = 7;
+					tag_info->uid_len = 10;
 					result = 0;
 				}
 			}
 			/* jscpd:ignore-end */
-		} while (known_bits < 40);
+		} while (known_bits < ISO14443A_CASCADE_LEVEL_BITS);
 
 		// Reset antcl bit
 		(void)st25r391x_write_register_byte_check(
@@ -407,7 +525,11 @@ static s32 st25r391x_nfca_do_select(struct st25r391x_i2c_data *priv,
 	return result;
 }
 
-static s32 st25r391x_nfca_reqa(struct st25r391x_i2c_data *priv, u8 atqa[])
+/**
+ * Send REQA, or WUPA to also wake up tags in HALT state, and read ATQA.
+ */
+static s32 st25r391x_nfca_reqa(struct st25r391x_i2c_data *priv, u8 atqa[],
+			       int wakeup)
 {
 	s32 result;
 	struct i2c_client *i2c = priv->i2c;
@@ -437,26 +559,27 @@ static s32 st25r391x_nfca_reqa(struct st25r391x_i2c_data *priv, u8 atqa[])
 				ST25R391X_MAIN_INTERRUPT_REGISTER_l_rxe,
 			0, 0, 0);
 
-		// Write Transmit REQA command
+		// Write Transmit REQA or WUPA command
 		result = st25r391x_direct_command(
-			i2c, ST25R391X_TRANSMIT_REQA_COMMAND_CODE);
+			i2c, wakeup ? ST25R391X_TRANSMIT_WUPA_COMMAND_CODE :
+				      ST25R391X_TRANSMIT_REQA_COMMAND_CODE);
 		if (result < 0) {
 			dev_err(priv->device,
-				"st25r391x_nfca_reqa: failed to send Transmit REQA command %d",
-				result);
+				"st25r391x_nfca_reqa: failed to send Transmit %s command %d",
+				wakeup ? "WUPA" : "REQA", result);
 			break;
 		}
 		// Receive data (ATQA)
 		result = st25r391x_polling_wait_for_interrupt_bit(
 			i2c, ints, ST25R391X_MAIN_INTERRUPT_REGISTER_l_rxs, 0,
-			0, 0, 5000); // TODO: fix timeout
+			0, 0, ST25R391X_NFCA_FDT_USEC);
 		if (result < 0) {
 			break;
 		}
 
 		result = st25r391x_polling_wait_for_interrupt_bit(
 			i2c, ints, ST25R391X_MAIN_INTERRUPT_REGISTER_l_rxe, 0,
-			0, 0, 5000); // TODO: fix timeout
+			0, 0, ST25R391X_FRAME_USEC(2));
 		if (result < 0) {
 			break;
 		}
@@ -471,6 +594,35 @@ static s32 st25r391x_nfca_reqa(struct st25r391x_i2c_data *priv, u8 atqa[])
 	return result;
 }
 
+/**
+ * Put selected tag in HALT state, so it only answers WUPA.
+ */
+static s32 st25r391x_nfca_hlta(struct st25r391x_i2c_data *priv)
+{
+	u8 buffer[2];
+
+	buffer[0] = ISO14443A_COMMAND_HLTA;
+	buffer[1] = 0x00;
+	return st25r391x_transceive_frame(priv->i2c, &priv->ints, buffer, 2,
+					  NULL, 0, transceive_frame_tx_only,
+					  0);
+}
+
+/**
+ * Return the frame waiting time of a tag, from its ATS if it was activated
+ * with RATS.
+ */
+static u32 st25r391x_nfca_fwt_usec(
+	const struct nfc_detected_tag_message_payload *tag_payload)
+{
+	if (tag_payload->tag_type != NFC_TAG_TYPE_ISO14443A_T4T &&
+	    tag_payload->tag_type != NFC_TAG_TYPE_ISO14443A_T4T_NFCDEP) {
+		return ST25R391X_NFCA_T2T_FWT_USEC;
+	}
+	return st25r391x_iso14443_fwt_usec(
+		st25r391x_nfca_ats_tb(&tag_payload->tag_info.iso14443a4) >> 4);
+}
+
 static void st25r391x_nfca_process_tag(
 	struct st25r391x_i2c_data *priv,
 	const struct nfc_detected_tag_message_payload *tag_payload, int select)
@@ -480,33 +632,33 @@ static void st25r391x_nfca_process_tag(
 
 	if (select) {
 		matching_type = tag_type ==
-				priv->mode_params.select.tag_id.tag_type;
+				priv->mode_params->select.tag_id.tag_type;
 	} else {
-		matching_type = priv->mode_params.discover.protocols &
+		matching_type = priv->mode_params->discover.protocols &
 				NFC_TAG_PROTOCOL_ISO14443A4;
 		matching_type =
 			matching_type ?
 				      1 :
-				      priv->mode_params.discover.protocols &
+				      priv->mode_params->discover.protocols &
 						NFC_TAG_PROTOCOL_ISO14443A_T2T &&
 					tag_type == NFC_TAG_TYPE_ISO14443A_T2T;
 		matching_type =
 			matching_type ?
 				      1 :
-				      priv->mode_params.discover.protocols &
+				      priv->mode_params->discover.protocols &
 						NFC_TAG_PROTOCOL_MIFARE_CLASSIC &&
 					tag_type == NFC_TAG_TYPE_MIFARE_CLASSIC;
 		matching_type =
 			matching_type ?
 				      1 :
-				      priv->mode_params.discover.protocols &
+				      priv->mode_params->discover.protocols &
 						NFC_TAG_PROTOCOL_ISO14443A_NFCDEP &&
 					tag_type ==
 						NFC_TAG_TYPE_ISO14443A_NFCDEP;
 		matching_type =
 			matching_type ?
 				      1 :
-				      priv->mode_params.discover.protocols &
+				      priv->mode_params->discover.protocols &
 						NFC_TAG_PROTOCOL_ISO14443A4 &&
 					(tag_type ==
 						 NFC_TAG_TYPE_ISO14443A_T4T ||
@@ -515,13 +667,13 @@ static void st25r391x_nfca_process_tag(
 		matching_type =
 			matching_type ?
 				      1 :
-				      priv->mode_params.discover.protocols &
+				      priv->mode_params->discover.protocols &
 						NFC_TAG_PROTOCOL_ISO14443A_T4T &&
 					tag_type == NFC_TAG_TYPE_ISO14443A_T4T;
 		matching_type =
 			matching_type ?
 				      1 :
-				      priv->mode_params.discover.protocols &
+				      priv->mode_params->discover.protocols &
 						NFC_TAG_PROTOCOL_ISO14443A_T4T_NFCDEP &&
 					tag_type ==
 						NFC_TAG_TYPE_ISO14443A_T4T_NFCDEP;
@@ -538,93 +690,129 @@ static void st25r391x_nfca_process_tag(
 		} else {
 			cid = tag_payload->tag_info.iso14443a4.sak;
 		}
-		st25r391x_process_selected_tag(priv, tag_payload, cid);
+		st25r391x_process_selected_tag(
+			priv, tag_payload, cid,
+			st25r391x_nfca_fwt_usec(tag_payload));
+	}
+}
+
+/**
+ * Activate ISO14443-4 with RATS if tag supports it and return the tag type.
+ */
+static u8 st25r391x_nfca_activate(struct st25r391x_i2c_data *priv,
+				  struct nfc_tag_info_iso14443a4 *tag_info)
+{
+	u8 tag_type = NFC_TAG_TYPE_ISO14443A;
+	u8 sak = tag_info->sak;
+
+	if (sak & 0x20 && st25r391x_nfca_rats(priv, tag_info) >= 0) {
+		if ((sak & 0x60) == 0x60) {
+			return NFC_TAG_TYPE_ISO14443A_T4T_NFCDEP;
+		}
+		return NFC_TAG_TYPE_ISO14443A_T4T;
+	}
+
+	if ((sak & 0x60) == 0) {
+		tag_type = NFC_TAG_TYPE_ISO14443A_T2T;
+	} else if ((sak & 0x60) == 0x40) {
+		tag_type = NFC_TAG_TYPE_ISO14443A_NFCDEP;
+	}
+
+	// Apply AN10833 logic to catch MIFARE Classic
+	if (!(sak & 0x02)) { // bit 2 == 0
+		if (sak & 0x08) { // bit 4 == 1
+			if (sak & 0x10) { // bit 5 == 1
+				if (sak & 0x01) { // bit 1 == 1
+					// MIFARE Classic 2K
+					tag_type = NFC_TAG_TYPE_MIFARE_CLASSIC;
+				} else { // bit 1 == 0
+					// MIFARE Classic 4K
+					// SmartMX with MIFARE Classic 4K
+					tag_type = NFC_TAG_TYPE_MIFARE_CLASSIC;
+				}
+			} else { // bit 5 == 0
+				if (sak & 0x01) { // bit 1 == 1
+					// MIFARE Mini
+					tag_type = NFC_TAG_TYPE_MIFARE_CLASSIC;
+				} else { // bit 1 == 0
+					// MIFARE Classic 1K
+					// SmartMX with MIFARE Classic 1K
+					tag_type = NFC_TAG_TYPE_MIFARE_CLASSIC;
+				}
+			}
+		}
 	}
+	return tag_type;
 }
 
+/**
+ * Put tag in HALT state so it no longer answers REQA: with S(DESELECT) if it
+ * was activated with RATS, with HLTA otherwise.
+ */
+static void st25r391x_nfca_halt(
+	struct st25r391x_i2c_data *priv,
+	const struct nfc_detected_tag_message_payload *tag_payload)
+{
+	u8 buffer[1];
+
+	if (tag_payload->tag_type == NFC_TAG_TYPE_ISO14443A_T4T ||
+	    tag_payload->tag_type == NFC_TAG_TYPE_ISO14443A_T4T_NFCDEP) {
+		buffer[0] = ISO14443_4_S_DESELECT;
+		(void)st25r391x_transceive_frame(
+			priv->i2c, &priv->ints, buffer, 1, buffer,
+			sizeof(buffer), 0,
+			st25r391x_nfca_fwt_usec(tag_payload));
+	} else {
+		(void)st25r391x_nfca_hlta(priv);
+	}
+}
+
+/**
+ * Resolve tags in the field one after the other, halting each of them so the
+ * next REQA is only answered by the others, until no tag answers or a tag is
+ * selected.
+ */
 static void st25r391x_nfca_poll(struct st25r391x_i2c_data *priv, int select)
 {
 	// Passive poll NFC-A
 	struct nfc_detected_tag_message_payload tag_payload;
+	enum st25r391x_mode mode = priv->mode;
+	u8 count;
 	s32 result;
 
-	memset(&tag_payload, 0, sizeof(tag_payload));
-	result =
-		st25r391x_nfca_reqa(priv, tag_payload.tag_info.iso14443a4.atqa);
-	if (result == 2) {
+	// present_tags bounds the number of tags reported in a cycle.
+	for (count = 0; count < MAX_PRESENT_TAGS && priv->mode == mode;
+	     count++) {
+		memset(&tag_payload, 0, sizeof(tag_payload));
+		// In select mode, the first request of a field session is a
+		// WUPA in case a client halted the tag. Others are REQA so that
+		// tags halted below stay halted.
+		result = st25r391x_nfca_reqa(
+			priv, tag_payload.tag_info.iso14443a4.atqa,
+			select && count == 0 && !priv->select_field_kept);
+		if (result != 2)
+			break;
 		result = st25r391x_nfca_do_select(
 			priv, &tag_payload.tag_info.iso14443a4);
-		if (result >= 0) {
-			u8 tag_type = NFC_TAG_TYPE_ISO14443A;
-			u8 sak = tag_payload.tag_info.iso14443a4.sak;
-			int rats_succeeded = 0;
-			if (sak & 0x20) {
-				result = st25r391x_nfca_rats(
-					priv, &tag_payload.tag_info.iso14443a4);
-				if (result >= 0) {
-					if ((sak & 0x60) == 0x60) {
-						tag_type =
-							NFC_TAG_TYPE_ISO14443A_T4T_NFCDEP;
-					} else {
-						tag_type =
-							NFC_TAG_TYPE_ISO14443A_T4T;
-					}
-					rats_succeeded = 1;
-				}
-			}
-
-			if (!rats_succeeded) {
-				if ((sak & 0x60) == 0) {
-					tag_type = NFC_TAG_TYPE_ISO14443A_T2T;
-				} else if ((sak & 0x60) == 0x40) {
-					tag_type =
-						NFC_TAG_TYPE_ISO14443A_NFCDEP;
-				}
-
-				// Apply AN10833 logic to catch MIFARE Classic
-				if (!(sak & 0x02)) { // bit 2 == 0
-					if (sak & 0x08) { // bit 4 == 1
-						if (sak & 0x10) { // bit 5 == 1
-							if (sak &
-							    0x01) { // bit 1 == 1
-								// MIFARE Classic 2K
-								tag_type =
-									NFC_TAG_TYPE_MIFARE_CLASSIC;
-							} else { // bit 1 == 0
-								// MIFARE Classic 4K
-								// SmartMX with MIFARE Classic 4K
-								tag_type =
-									NFC_TAG_TYPE_MIFARE_CLASSIC;
-							}
-						} else { // bit 5 == 0
-							if (sak &
-							    0x01) { // bit 1 == 1
-								// MIFARE Mini
-								tag_type =
-									NFC_TAG_TYPE_MIFARE_CLASSIC;
-							} else { // bit 1 == 0
-								// MIFARE Classic 1K
-								// SmartMX with MIFARE Classic 1K
-								tag_type =
-									NFC_TAG_TYPE_MIFARE_CLASSIC;
-							}
-						}
-					}
-				}
-			}
-
-			tag_payload.tag_type = tag_type;
-			if (select == 0 ||
-			    (priv->mode_params.select.tag_id.uid_len ==
-				     tag_payload.tag_info.iso14443a.uid_len &&
-			     memcmp(priv->mode_params.select.tag_id.uid,
-				    tag_payload.tag_info.iso14443a.uid,
-				    tag_payload.tag_info.iso14443a.uid_len) ==
-				     0)) {
-				st25r391x_nfca_process_tag(priv, &tag_payload,
-							   select);
-			}
+		if (result < 0)
+			break;
+		if (select &&
+		    (priv->mode_params->select.tag_id.uid_len !=
+			     tag_payload.tag_info.iso14443a.uid_len ||
+		     memcmp(priv->mode_params->select.tag_id.uid,
+			    tag_payload.tag_info.iso14443a.uid,
+			    tag_payload.tag_info.iso14443a.uid_len) != 0)) {
+			// Not the tag we're looking for, halt it until WUPA.
+			(void)st25r391x_nfca_hlta(priv);
+			continue;
 		}
+		tag_payload.tag_type = st25r391x_nfca_activate(
+			priv, &tag_payload.tag_info.iso14443a4);
+		st25r391x_nfca_process_tag(priv, &tag_payload, select);
+		// Selected tag is kept active.
+		if (priv->mode != mode)
+			break;
+		st25r391x_nfca_halt(priv, &tag_payload);
 	}
 }
 
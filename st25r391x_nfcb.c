@@ -86,6 +86,15 @@ s32 st25r391x_set_iso14443b_mode(struct i2c_client *i2c)
 	return result;
 }
 
+/**
+ * Return the frame waiting time of a tag, from FWI in its ATQB protocol info.
+ */
+static u32
+st25r391x_nfcb_fwt_usec(const struct nfc_tag_info_iso14443b *tag_info)
+{
+	return st25r391x_iso14443_fwt_usec(tag_info->protocol_info[2] >> 4);
+}
+
 static s32 st25r391x_nfcb_reqb_cid(struct st25r391x_i2c_data *priv,
 				   struct nfc_tag_info_iso14443b *tag_info,
 				   u8 cid)
@@ -118,7 +127,7 @@ static s32 st25r391x_nfcb_reqb_cid(struct st25r391x_i2c_data *priv,
 		buffer[2] = ISO14443B_COMMAND_REQB_PARAM_NORMAL_N1;
 		result = st25r391x_transceive_frame(
 			i2c, ints, buffer, 3, buffer, sizeof(buffer), 0,
-			539); // Max TR0 for ATQB is 256/fs and max TR1 is 200/fs
+			ST25R391X_NFCB_ATQB_FWT_USEC);
 		if (result < 0)
 			break;
 
@@ -138,7 +147,7 @@ static s32 st25r391x_nfcb_reqb_cid(struct st25r391x_i2c_data *priv,
 		buffer[8] = cid; // CID
 		result = st25r391x_transceive_frame(
 			i2c, ints, buffer, 9, buffer, sizeof(buffer), 0,
-			5000); // TODO: check rx timeout
+			st25r391x_nfcb_fwt_usec(tag_info));
 		if (result < 0)
 			break;
 
@@ -161,10 +170,13 @@ void st25r391x_nfcb_discover(struct st25r391x_i2c_data *priv)
 	memset(&tag_payload, 0, sizeof(tag_payload));
 	result = st25r391x_nfcb_reqb_cid(priv, &tag_payload.tag_info.iso14443b,
 					 cid);
-	if (result >= 0 &&
-	    priv->mode_params.discover.protocols & NFC_TAG_PROTOCOL_ISO14443B) {
+	if (result >= 0 && priv->mode_params->discover.protocols &
+				   NFC_TAG_PROTOCOL_ISO14443B) {
 		tag_payload.tag_type = NFC_TAG_TYPE_ISO14443B;
-		st25r391x_process_selected_tag(priv, &tag_payload, cid);
+		st25r391x_process_selected_tag(
+			priv, &tag_payload, cid,
+			st25r391x_nfcb_fwt_usec(
+				&tag_payload.tag_info.iso14443b));
 	}
 }
 
@@ -180,10 +192,13 @@ void st25r391x_nfcb_select(struct st25r391x_i2c_data *priv)
 	result = st25r391x_nfcb_reqb_cid(priv, &tag_payload.tag_info.iso14443b,
 					 cid);
 	if (result >= 0 &&
-	    memcmp(priv->mode_params.select.tag_id.uid,
+	    memcmp(priv->mode_params->select.tag_id.uid,
 		   tag_payload.tag_info.iso14443b.pupi,
 		   sizeof(tag_payload.tag_info.iso14443b.pupi)) == 0) {
 		tag_payload.tag_type = NFC_TAG_TYPE_ISO14443B;
-		st25r391x_process_selected_tag(priv, &tag_payload, cid);
+		st25r391x_process_selected_tag(
+			priv, &tag_payload, cid,
+			st25r391x_nfcb_fwt_usec(
+				&tag_payload.tag_info.iso14443b));
 	}
 }
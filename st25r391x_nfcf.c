@@ -104,10 +104,10 @@ static s32 st25r391x_nfcf_poll(struct st25r391x_i2c_data *priv,
 		buffer[0] = NFCF_COMMAND_SENSF_REQ;
 		buffer[1] = 0xFF;
 		buffer[2] = 0xFF;
-		buffer[3] = 0x00;
+		buffer[3] = 0x00; // TSN: a single time slot
 		result = st25r391x_transceive_frame(
 			i2c, ints, buffer, 4, buffer, sizeof(buffer), 0,
-			5000); // TODO: check rx timeout
+			ST25R391X_NFCF_SENSF_RES_USEC(0));
 		if (result < 0)
 			break;
 
@@ -127,7 +127,7 @@ void st25r391x_nfcf_discover(struct st25r391x_i2c_data *priv)
 	memset(&tag_payload, 0, sizeof(tag_payload));
 	result = st25r391x_nfcf_poll(priv, &tag_payload.tag_info.nfcf);
 	if (result >= 0 &&
-	    priv->mode_params.discover.protocols &
+	    priv->mode_params->discover.protocols &
 		    (NFC_TAG_PROTOCOL_NFCF | NFC_TAG_PROTOCOL_NFCF_NFCDEP)) {
 		tag_payload.tag_type = NFC_TAG_TYPE_NFCF;
 		// TODO
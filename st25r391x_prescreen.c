@@ -0,0 +1,121 @@
+/* SPDX-License-Identifier: GPL-2.0+ WITH Linux-syscall-note */
+/*
+ * ST25R3916/7 NFC Reader Driver
+ *
+ * Copyright (C) 2020-2022 Paul Guyot <pguyot@kallisys.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA
+ */
+
+#include <linux/i2c.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+
+#include "st25r391x_commands.h"
+#include "st25r391x_common.h"
+#include "st25r391x_prescreen.h"
+#include "st25r391x.h"
+
+// Cycles skipped before technologies are polled anyway
+#define PRESCREEN_FORCED_POLL_CYCLES 50
+// Threshold bounds, in A/D converter LSB
+#define PRESCREEN_MIN_THRESHOLD 1
+#define PRESCREEN_MAX_THRESHOLD 16
+// Baseline is a moving average over 2^PRESCREEN_BASELINE_SHIFT measurements
+#define PRESCREEN_BASELINE_SHIFT 3
+
+static bool st25r391x_prescreen_changed(u16 baseline, u8 value, u8 threshold)
+{
+	return abs((int)(baseline >> PRESCREEN_BASELINE_SHIFT) - value) >
+	       threshold;
+}
+
+static void st25r391x_prescreen_average(u16 *baseline, u8 value)
+{
+	*baseline = *baseline - (*baseline >> PRESCREEN_BASELINE_SHIFT) +
+		    value;
+}
+
+bool st25r391x_prescreen(struct st25r391x_i2c_data *priv)
+{
+	struct st25r391x_prescreen_state *prescreen = &priv->prescreen;
+	s32 result;
+
+	prescreen->sensed = 1;
+	result = st25r391x_measure(priv->i2c, &priv->ints,
+				   ST25R391X_MEASURE_AMPLITUDE_COMMAND_CODE);
+	if (result < 0)
+		return true;
+	prescreen->amplitude = result;
+	result = st25r391x_measure(priv->i2c, &priv->ints,
+				   ST25R391X_MEASURE_PHASE_COMMAND_CODE);
+	if (result < 0)
+		return true;
+	prescreen->phase = result;
+
+	if (!prescreen->valid ||
+	    st25r391x_prescreen_changed(prescreen->amplitude_baseline,
+					prescreen->amplitude,
+					prescreen->threshold) ||
+	    st25r391x_prescreen_changed(prescreen->phase_baseline,
+					prescreen->phase,
+					prescreen->threshold))
+		return true;
+
+	prescreen->sensed = 0;
+	if (prescreen->skipped >= PRESCREEN_FORCED_POLL_CYCLES)
+		return true;
+
+	prescreen->skipped++;
+	priv->power_stats.prescreen_skips++;
+	st25r391x_prescreen_average(&prescreen->amplitude_baseline,
+				    prescreen->amplitude);
+	st25r391x_prescreen_average(&prescreen->phase_baseline,
+				    prescreen->phase);
+	return false;
+}
+
+void st25r391x_prescreen_result(struct st25r391x_i2c_data *priv, bool found)
+{
+	struct st25r391x_prescreen_state *prescreen = &priv->prescreen;
+
+	prescreen->skipped = 0;
+	priv->power_stats.prescreen_polls++;
+	if (found) {
+		if (prescreen->valid && !prescreen->sensed) {
+			// Forced poll found a tag the measurements missed.
+			priv->power_stats.prescreen_misses++;
+			prescreen->threshold =
+				max(prescreen->threshold / 2,
+				    PRESCREEN_MIN_THRESHOLD);
+		}
+		// Baseline is learnt again once tags are gone.
+		prescreen->valid = 0;
+		return;
+	}
+	if (!prescreen->valid) {
+		if (prescreen->threshold == 0)
+			prescreen->threshold = PRESCREEN_MIN_THRESHOLD;
+	} else if (prescreen->sensed &&
+		   prescreen->threshold < PRESCREEN_MAX_THRESHOLD) {
+		// Change without any tag: noise.
+		prescreen->threshold++;
+	}
+	prescreen->amplitude_baseline = prescreen->amplitude
+					<< PRESCREEN_BASELINE_SHIFT;
+	prescreen->phase_baseline = prescreen->phase
+				    << PRESCREEN_BASELINE_SHIFT;
+	prescreen->valid = 1;
+}
@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: GPL-2.0+ WITH Linux-syscall-note */
+/*
+ * ST25R3916/7 NFC Reader Driver
+ *
+ * Copyright (C) 2020-2022 Paul Guyot <pguyot@kallisys.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA
+ */
+
+#ifndef ST25R391X_PRESCREEN_H
+#define ST25R391X_PRESCREEN_H
+
+#include <linux/types.h>
+
+struct st25r391x_i2c_data;
+
+// Pre-screen of discovery cycles: with field on, amplitude and phase are
+// measured and compared to a baseline learnt on empty field. Technologies are
+// only polled when they changed, or periodically.
+
+// Return whether technologies should be polled.
+bool st25r391x_prescreen(struct st25r391x_i2c_data *priv);
+// Learn from the result of polling technologies.
+void st25r391x_prescreen_result(struct st25r391x_i2c_data *priv, bool found);
+
+#endif
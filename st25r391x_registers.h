@@ -218,6 +218,39 @@
 #define ST25R391X_AUXILIARY_DISPLAY_REGISTER_en_peer 0b00000010
 #define ST25R391X_AUXILIARY_DISPLAY_REGISTER_en_ac 0b00000001
 
+// ST25R3916/7 datasheet, DS12484 Rev 4, regulator registers
+#define ST25R391X_REGULATOR_VOLTAGE_CONTROL_REGISTER_reg_s 0b10000000
+#define ST25R391X_REGULATOR_VOLTAGE_CONTROL_REGISTER_rege_shift 3
+#define ST25R391X_REGULATOR_VOLTAGE_CONTROL_REGISTER_mpsv_mask 0b00000111
+#define ST25R391X_REGULATOR_VOLTAGE_CONTROL_REGISTER_mpsv_vdd 0b00000000
+#define ST25R391X_REGULATOR_DISPLAY_B_REGISTER_reg_shift 4
+#define ST25R391X_REGULATOR_DISPLAY_B_REGISTER_reg_mask 0b11110000
+// A/D converter output of measure power supply command is 23.4 mV per LSB
+#define ST25R391X_MEASURE_POWER_SUPPLY_UV_PER_LSB 23400
+
+// ST25R3916/7 datasheet, DS12484 Rev 4, wake-up registers
+#define ST25R391X_WAKEUP_TIMER_CONTROL_REGISTER_wur 0b10000000
+#define ST25R391X_WAKEUP_TIMER_CONTROL_REGISTER_wut_shift 4
+#define ST25R391X_WAKEUP_TIMER_CONTROL_REGISTER_wto 0b00001000
+#define ST25R391X_WAKEUP_TIMER_CONTROL_REGISTER_wam 0b00000100
+#define ST25R391X_WAKEUP_TIMER_CONTROL_REGISTER_wph 0b00000010
+#define ST25R391X_WAKEUP_TIMER_CONTROL_REGISTER_wcap 0b00000001
+// Amplitude and phase measurement configuration registers share layout
+#define ST25R391X_MEASUREMENT_CONFIGURATION_REGISTER_d_shift 4
+#define ST25R391X_MEASUREMENT_CONFIGURATION_REGISTER_aam 0b00001000
+#define ST25R391X_MEASUREMENT_CONFIGURATION_REGISTER_aew_4 0b00000000
+#define ST25R391X_MEASUREMENT_CONFIGURATION_REGISTER_aew_8 0b00000010
+#define ST25R391X_MEASUREMENT_CONFIGURATION_REGISTER_aew_16 0b00000100
+#define ST25R391X_MEASUREMENT_CONFIGURATION_REGISTER_aew_32 0b00000110
+#define ST25R391X_MEASUREMENT_CONFIGURATION_REGISTER_ae 0b00000001
+
+// ST25R3916/7 datasheet, DS12484 Rev 4, collision avoidance timings in 1/fc
+// External field is checked for T_IDT + n * T_RFW before field on, and l_cat
+// is raised when NFC field on guard timer expires, counting in 4096/fc steps.
+#define ST25R391X_COLLISION_AVOIDANCE_T_IDT_FC 4096
+#define ST25R391X_COLLISION_AVOIDANCE_T_RFW_FC 512
+#define ST25R391X_NFC_FILED_ON_GUARD_TIMER_B_REGISTER_step_fc 4096
+
 // ST25R3916/7 datasheet, DS12484 Rev 4, page 23/157
 #define ST25R391X_TEST_SPACE_OVERHEAT_PROTECTION_REGISTER 0x04
 #define ST25R391X_TEST_SPACE_OVERHEAT_PROTECTION_VALUE 0x10
@@ -62,7 +62,7 @@ st25r391x_st25tb_select_and_get_uid(struct st25r391x_i2c_data *priv,
 		buffer[1] = chip_id;
 		result = st25r391x_transceive_frame(
 			i2c, ints, buffer, 2, buffer, sizeof(buffer), 0,
-			5000); // TODO: check rx timeout
+			ST25R391X_NFCB_ATQB_FWT_USEC);
 		if (result < 0)
 			break;
 
@@ -77,7 +77,7 @@ st25r391x_st25tb_select_and_get_uid(struct st25r391x_i2c_data *priv,
 		buffer[0] = ST25TB_COMMAND_GET_UID;
 		result = st25r391x_transceive_frame(
 			i2c, ints, buffer, 1, buffer, sizeof(buffer), 0,
-			5000); // TODO: check rx timeout
+			ST25R391X_NFCB_ATQB_FWT_USEC);
 		if (result < 0)
 			break;
 
@@ -126,7 +126,7 @@ static s32 st25r391x_st25tb_initiate(struct st25r391x_i2c_data *priv,
 		buffer[1] = ST25TB_COMMAND_INITIATE_L;
 		result = st25r391x_transceive_frame(
 			i2c, ints, buffer, 2, buffer, sizeof(buffer), 0,
-			5000); // TODO: check rx timeout
+			ST25R391X_NFCB_ATQB_FWT_USEC);
 		if (result < 0)
 			break;
 
@@ -156,9 +156,10 @@ void st25r391x_st25tb_discover(struct st25r391x_i2c_data *priv)
 	result = st25r391x_st25tb_initiate(priv, &tag_payload.tag_info.st25tb,
 					   &cid);
 	if (result >= 0 &&
-	    priv->mode_params.discover.protocols & NFC_TAG_PROTOCOL_ST25TB) {
+	    priv->mode_params->discover.protocols & NFC_TAG_PROTOCOL_ST25TB) {
 		tag_payload.tag_type = NFC_TAG_TYPE_ST25TB;
-		st25r391x_process_selected_tag(priv, &tag_payload, cid);
+		st25r391x_process_selected_tag(priv, &tag_payload, cid,
+					       ST25R391X_NFCB_ATQB_FWT_USEC);
 	}
 }
 
@@ -173,10 +174,11 @@ void st25r391x_st25tb_select(struct st25r391x_i2c_data *priv)
 	result = st25r391x_st25tb_initiate(priv, &tag_payload.tag_info.st25tb,
 					   &cid);
 	if (result >= 0 &&
-	    memcmp(priv->mode_params.select.tag_id.uid,
+	    memcmp(priv->mode_params->select.tag_id.uid,
 		   tag_payload.tag_info.st25tb.uid,
 		   sizeof(tag_payload.tag_info.st25tb.uid)) == 0) {
 		tag_payload.tag_type = NFC_TAG_TYPE_ST25TB;
-		st25r391x_process_selected_tag(priv, &tag_payload, cid);
+		st25r391x_process_selected_tag(priv, &tag_payload, cid,
+					       ST25R391X_NFCB_ATQB_FWT_USEC);
 	}
 }
@@ -0,0 +1,168 @@
+/* SPDX-License-Identifier: GPL-2.0+ WITH Linux-syscall-note */
+/*
+ * ST25R3916/7 NFC Reader Driver
+ *
+ * Copyright (C) 2020-2022 Paul Guyot <pguyot@kallisys.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA
+ */
+
+#include <linux/i2c.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+
+#include "st25r391x_commands.h"
+#include "st25r391x_common.h"
+#include "st25r391x_i2c.h"
+#include "st25r391x_registers.h"
+#include "st25r391x_wakeup.h"
+#include "st25r391x.h"
+
+// Difference with reference triggering a wake-up, in A/D converter LSB
+#define WAKEUP_AMPLITUDE_DELTA 2
+#define WAKEUP_PHASE_DELTA 2
+
+/**
+ * Convert interval to wake-up timer control register value.
+ * Timer counts 1 to 8 periods of 10 ms or 100 ms.
+ */
+static u8 st25r391x_wakeup_timer(unsigned int interval_ms)
+{
+	u8 wur = 0;
+	unsigned int periods;
+
+	if (interval_ms <= 80) {
+		wur = ST25R391X_WAKEUP_TIMER_CONTROL_REGISTER_wur;
+		periods = clamp(interval_ms / 10, 1U, 8U);
+	} else {
+		periods = clamp(interval_ms / 100, 1U, 8U);
+	}
+	periods--;
+	return wur |
+	       periods << ST25R391X_WAKEUP_TIMER_CONTROL_REGISTER_wut_shift;
+}
+
+/**
+ * Amplitude or phase measurement configuration for a given delta, comparing
+ * measurements to the auto-averaged value.
+ */
+static u8 st25r391x_wakeup_measurement(u8 delta)
+{
+	u8 d = delta << ST25R391X_MEASUREMENT_CONFIGURATION_REGISTER_d_shift;
+
+	return d | ST25R391X_MEASUREMENT_CONFIGURATION_REGISTER_aew_16 |
+	       ST25R391X_MEASUREMENT_CONFIGURATION_REGISTER_ae;
+}
+
+/**
+ * Measure amplitude and phase with current field, to be used as references.
+ */
+static s32 st25r391x_wakeup_calibrate(struct st25r391x_i2c_data *priv)
+{
+	struct i2c_client *i2c = priv->i2c;
+	s32 result;
+
+	do {
+		result = st25r391x_measure(
+			i2c, &priv->ints,
+			ST25R391X_MEASURE_AMPLITUDE_COMMAND_CODE);
+		if (result < 0)
+			break;
+		priv->wakeup.amplitude_reference = result;
+		result = st25r391x_measure(
+			i2c, &priv->ints, ST25R391X_MEASURE_PHASE_COMMAND_CODE);
+		if (result < 0)
+			break;
+		priv->wakeup.phase_reference = result;
+	} while (0);
+	return result;
+}
+
+s32 st25r391x_wakeup_enter(struct st25r391x_i2c_data *priv,
+			   unsigned int interval_ms)
+{
+	struct i2c_client *i2c = priv->i2c;
+	s32 result;
+
+	do {
+		// References are measured with the field of the poll that just
+		// found no tag.
+		result = st25r391x_wakeup_calibrate(priv);
+		if (result < 0) {
+			dev_err(priv->device,
+				"st25r391x_wakeup_enter: Failed to calibrate references: %d",
+				result);
+			break;
+		}
+		result = st25r391x_turn_field_off(priv);
+		if (result < 0)
+			break;
+
+		// With auto-averaging, reference registers are the initial
+		// values of the average, which then tracks slow changes.
+		result = st25r391x_write_registers_check(
+			i2c, ST25R391X_AMPLITUDE_MEASUREMENT_CONFIGURATION_REGISTER,
+			2, st25r391x_wakeup_measurement(WAKEUP_AMPLITUDE_DELTA),
+			priv->wakeup.amplitude_reference);
+		if (result < 0)
+			break;
+		result = st25r391x_write_registers_check(
+			i2c, ST25R391X_PHASE_MEASUREMENT_CONFIGURATION_REGISTER,
+			2, st25r391x_wakeup_measurement(WAKEUP_PHASE_DELTA),
+			priv->wakeup.phase_reference);
+		if (result < 0)
+			break;
+		result = st25r391x_write_register_byte_check(
+			i2c, ST25R391X_WAKEUP_TIMER_CONTROL_REGISTER,
+			st25r391x_wakeup_timer(interval_ms) |
+				ST25R391X_WAKEUP_TIMER_CONTROL_REGISTER_wam |
+				ST25R391X_WAKEUP_TIMER_CONTROL_REGISTER_wph);
+		if (result < 0)
+			break;
+
+		// Discard pending wake-up interrupts
+		result = st25r391x_read_register_byte(
+			i2c, ST25R391X_ERROR_AND_WAKEUP_INTERRUPT_REGISTER);
+		if (result < 0)
+			break;
+
+		// Oscillator is stopped in wake-up mode
+		result = st25r391x_write_register_byte_check(
+			i2c, ST25R391X_OPERATION_CONTROL_REGISTER,
+			ST25R391X_OPERATION_CONTROL_REGISTER_wu);
+		priv->oscillator_on = 0;
+		if (result < 0)
+			break;
+		priv->wakeup.enabled = 1;
+		priv->power_stats.wake_up_entries++;
+	} while (0);
+	return result;
+}
+
+s32 st25r391x_wakeup_check(struct st25r391x_i2c_data *priv)
+{
+	s32 result;
+
+	result = st25r391x_read_register_byte(
+		priv->i2c, ST25R391X_ERROR_AND_WAKEUP_INTERRUPT_REGISTER);
+	if (result < 0)
+		return result;
+	if (result & (ST25R391X_ERROR_AND_WAKEUP_INTERRUPT_REGISTER_l_wam |
+		      ST25R391X_ERROR_AND_WAKEUP_INTERRUPT_REGISTER_l_wph)) {
+		priv->power_stats.wake_ups++;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,238 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Throughput of /dev/nfc0 with read()/write() and with io_uring passthrough
+ * commands, on the same workload.
+ *
+ * Workload emulates a client exchanging requests with the driver without
+ * depending on tags in the field: batches of identify requests, answered by
+ * the driver without RF activity, are written at once and their responses are
+ * read until the whole batch was answered.
+ *
+ * Usage: nfc_bench [-d device] [-n batches] [-b batch size] [rw|uring|all]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <liburing.h>
+
+#include "nfc.h"
+
+#define MAX_BATCH_SIZE 256
+#define READ_BUFFER_SIZE 4096
+
+static uint8_t requests[MAX_BATCH_SIZE * sizeof(struct nfc_message_header)];
+static uint8_t responses[READ_BUFFER_SIZE];
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t prepare_requests(unsigned batch_size)
+{
+	struct nfc_message_header header;
+	unsigned ix;
+
+	header.message_type = NFC_IDENTIFY_REQUEST_MESSAGE_TYPE;
+	header.payload_length = 0;
+	for (ix = 0; ix < batch_size; ix++) {
+		memcpy(requests + ix * sizeof(header), &header, sizeof(header));
+	}
+	return batch_size * sizeof(header);
+}
+
+/**
+ * Count identify responses in len bytes of whole messages.
+ */
+static unsigned count_responses(const uint8_t *buffer, size_t len)
+{
+	struct nfc_message_header header;
+	unsigned count = 0;
+	size_t offset = 0;
+
+	while (offset + sizeof(header) <= len) {
+		memcpy(&header, buffer + offset, sizeof(header));
+		if (header.message_type == NFC_IDENTIFY_RESPONSE_MESSAGE_TYPE) {
+			count++;
+		}
+		offset += sizeof(header) + header.payload_length;
+	}
+	return count;
+}
+
+static int run_rw(int fd, unsigned batches, unsigned batch_size)
+{
+	size_t requests_len = prepare_requests(batch_size);
+	unsigned batch;
+	unsigned answered;
+	ssize_t result;
+
+	for (batch = 0; batch < batches; batch++) {
+		result = write(fd, requests, requests_len);
+		if (result != (ssize_t)requests_len) {
+			perror("write");
+			return -1;
+		}
+		answered = 0;
+		while (answered < batch_size) {
+			result = read(fd, responses, sizeof(responses));
+			if (result < 0) {
+				perror("read");
+				return -1;
+			}
+			answered += count_responses(responses, result);
+		}
+	}
+	return 0;
+}
+
+static void prep_uring_cmd(struct io_uring_sqe *sqe, int fd, uint32_t cmd_op,
+			   void *buffer, uint32_t len)
+{
+	struct nfc_uring_cmd cmd;
+
+	io_uring_prep_rw(IORING_OP_URING_CMD, sqe, fd, NULL, 0, 0);
+	sqe->cmd_op = cmd_op;
+	cmd.addr = (uintptr_t)buffer;
+	cmd.len = len;
+	cmd.reserved = 0;
+	memcpy(sqe->cmd, &cmd, sizeof(cmd));
+}
+
+static int run_uring(int fd, unsigned batches, unsigned batch_size)
+{
+	size_t requests_len = prepare_requests(batch_size);
+	struct io_uring ring;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	unsigned batch;
+	unsigned answered;
+	size_t written;
+	int result;
+
+	result = io_uring_queue_init(8, &ring, 0);
+	if (result < 0) {
+		fprintf(stderr, "io_uring_queue_init: %s\n", strerror(-result));
+		return -1;
+	}
+	for (batch = 0; batch < batches && result >= 0; batch++) {
+		written = 0;
+		while (written < requests_len && result >= 0) {
+			sqe = io_uring_get_sqe(&ring);
+			prep_uring_cmd(sqe, fd, NFC_URING_CMD_WRITE,
+				       requests + written,
+				       requests_len - written);
+			io_uring_submit(&ring);
+			result = io_uring_wait_cqe(&ring, &cqe);
+			if (result == 0) {
+				result = cqe->res;
+				io_uring_cqe_seen(&ring, cqe);
+			}
+			if (result > 0) {
+				written += result;
+			}
+		}
+		answered = 0;
+		while (answered < batch_size && result >= 0) {
+			sqe = io_uring_get_sqe(&ring);
+			prep_uring_cmd(sqe, fd, NFC_URING_CMD_READ, responses,
+				       sizeof(responses));
+			io_uring_submit(&ring);
+			result = io_uring_wait_cqe(&ring, &cqe);
+			if (result == 0) {
+				result = cqe->res;
+				io_uring_cqe_seen(&ring, cqe);
+			}
+			if (result > 0) {
+				answered += count_responses(responses, result);
+			}
+		}
+	}
+	io_uring_queue_exit(&ring);
+	if (result < 0) {
+		fprintf(stderr, "uring_cmd: %s\n", strerror(-result));
+		return -1;
+	}
+	return 0;
+}
+
+static int bench(const char *name, const char *device,
+		 int (*run)(int, unsigned, unsigned), unsigned batches,
+		 unsigned batch_size)
+{
+	double start;
+	double elapsed;
+	int fd;
+	int result;
+
+	fd = open(device, O_RDWR);
+	if (fd < 0) {
+		perror(device);
+		return -1;
+	}
+	start = now();
+	result = run(fd, batches, batch_size);
+	elapsed = now() - start;
+	close(fd);
+	if (result == 0) {
+		printf("%-6s %u x %u requests in %.3f s: %.0f requests/s\n",
+		       name, batches, batch_size, elapsed,
+		       batches * batch_size / elapsed);
+	}
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	const char *device = "/dev/nfc0";
+	const char *mode = "all";
+	unsigned batches = 10000;
+	unsigned batch_size = 1;
+	int result = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:n:b:")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'n':
+			batches = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			batch_size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-d device] [-n batches] [-b batch size] [rw|uring|all]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc) {
+		mode = argv[optind];
+	}
+	if (batch_size == 0 || batch_size > MAX_BATCH_SIZE) {
+		fprintf(stderr, "batch size must be between 1 and %d\n",
+			MAX_BATCH_SIZE);
+		return 1;
+	}
+	if (strcmp(mode, "rw") == 0 || strcmp(mode, "all") == 0) {
+		result |= bench("rw", device, run_rw, batches, batch_size);
+	}
+	if (strcmp(mode, "uring") == 0 || strcmp(mode, "all") == 0) {
+		result |= bench("uring", device, run_uring, batches,
+				batch_size);
+	}
+	return result ? 1 : 0;
+}